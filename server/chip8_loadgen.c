@@ -0,0 +1,343 @@
+/* chip8-loadgen: opens many sessions on a chip8-server and measures it.
+ * usage: chip8-loadgen [--port N | --unix PATH] [--sessions N] [--seconds N]
+ *
+ * Every session presses a random key twice a second and decodes every
+ * frame it receives. At the end it reports the frame rate per session,
+ * the frame latency (time from the server tick to the frame being
+ * decoded) and the server capacity: the server reports how long its
+ * workers spent stepping sessions, which gives the cost of one session
+ * per tick and so how many sessions one core can step within a frame.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "types.h"
+#include "chip8.h"
+#include "chip8_delta.h"
+#include "chip8_net.h"
+
+enum {
+	DEFAULT_SESSIONS = 100,
+	DEFAULT_SECONDS = 10,
+	MAX_EVENTS = 256,
+	IN_BUFFER_SIZE = 2048,
+	LATENCY_BUCKETS = 10000, // 0.1 ms buckets, up to 1 s
+	KEY_INTERVAL_NS = 500000000,
+};
+
+typedef struct {
+	int fd;
+	u8 hello;
+	u8 key;
+	u64 next_key;
+	u64 frames;
+	u64 display[CHIP8_DISPLAY_HEIGHT];
+	u8 in[IN_BUFFER_SIZE];
+	u32 in_len;
+} client_t;
+
+static struct {
+	u64 latency[LATENCY_BUCKETS + 1];
+	u64 latency_count;
+	u64 frames;
+	u64 bytes;
+	u64 errors;
+	u16 workers;
+	u32 cycles;
+} stats;
+
+// totals reported by the server, see CHIP8_NET_MSG_STATS
+typedef struct {
+	u8 received;
+	u64 ticks;
+	u64 busy_ns;
+	u64 dropped;
+	u32 sessions;
+} server_stats_t;
+
+static server_stats_t server_stats;
+
+static u64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+static int connect_server(u16 port, const char *unix_path) {
+	int fd;
+
+	if (unix_path) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", unix_path);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			close(fd);
+			return -1;
+		}
+	}
+	else {
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		int yes = 1;
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			close(fd);
+			return -1;
+		}
+		if (fd >= 0)
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	}
+
+	if (fd >= 0)
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+// parses every complete message in the input buffer
+static void parse(client_t *c, u64 now) {
+	u32 pos = 0;
+
+	if (!c->hello) {
+		if (c->in_len < CHIP8_NET_HELLO_SIZE)
+			return;
+		if (read_u32(c->in) != CHIP8_NET_MAGIC || read_u16(c->in + 4) != CHIP8_NET_VERSION) {
+			stats.errors++;
+			c->in_len = 0;
+			return;
+		}
+		stats.workers = read_u16(c->in + 6);
+		stats.cycles = read_u32(c->in + 8);
+		c->hello = 1;
+		pos = CHIP8_NET_HELLO_SIZE;
+	}
+
+	while (c->in_len > pos) {
+		const u8 *msg = c->in + pos;
+
+		if (msg[0] == CHIP8_NET_MSG_STATS) {
+			if (c->in_len - pos < CHIP8_NET_STATS_SIZE)
+				break;
+			server_stats = (server_stats_t){
+				.received = 1,
+				.ticks = read_u64(msg + 1),
+				.busy_ns = read_u64(msg + 9),
+				.dropped = read_u64(msg + 17),
+				.sessions = read_u32(msg + 25),
+			};
+			stats.workers = read_u16(msg + 29);
+			pos += CHIP8_NET_STATS_SIZE;
+			continue;
+		}
+
+		if (msg[0] != CHIP8_NET_MSG_FRAME) {
+			stats.errors++;
+			pos = c->in_len;
+			break;
+		}
+		if (c->in_len - pos < CHIP8_NET_FRAME_HEADER_SIZE)
+			break;
+		u32 size = read_u16(msg + 1);
+		if (c->in_len - pos < CHIP8_NET_FRAME_HEADER_SIZE + size)
+			break;
+
+		if (chip8_delta_decode(msg + CHIP8_NET_FRAME_HEADER_SIZE, size, c->display) != size)
+			stats.errors++;
+
+		u64 sent = read_u64(msg + 7);
+		u64 bucket = now > sent ? (now - sent) / 100000 : 0;
+		stats.latency[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS]++;
+		stats.latency_count++;
+		stats.frames++;
+		c->frames++;
+		pos += CHIP8_NET_FRAME_HEADER_SIZE + size;
+	}
+
+	memmove(c->in, c->in + pos, c->in_len - pos);
+	c->in_len -= pos;
+}
+
+// reads everything available on the sockets, waiting up to timeout_ms
+static int poll_clients(int epoll_fd, int timeout_ms) {
+	struct epoll_event events[MAX_EVENTS];
+	int count = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+	u64 now = now_ns();
+
+	for (int i = 0; i < count; ++i) {
+		client_t *c = (client_t *)events[i].data.ptr;
+		ssize_t received;
+		while ((received = recv(c->fd, c->in + c->in_len, IN_BUFFER_SIZE - c->in_len, 0)) > 0) {
+			c->in_len += (u32)received;
+			stats.bytes += (u64)received;
+			parse(c, now);
+		}
+		if (received == 0)
+			return -1;
+	}
+	return 0;
+}
+
+// asks the server for its totals through the first session
+static int request_server_stats(int epoll_fd, client_t *c, server_stats_t *out) {
+	u8 request = CHIP8_NET_STATS_REQUEST;
+	server_stats.received = 0;
+	send(c->fd, &request, 1, MSG_NOSIGNAL);
+
+	u64 deadline = now_ns() + 1000000000ull;
+	while (!server_stats.received && now_ns() < deadline) {
+		if (poll_clients(epoll_fd, 5))
+			return -1;
+	}
+
+	*out = server_stats;
+	return server_stats.received ? 0 : -1;
+}
+
+static double percentile(double p) {
+	u64 target = (u64)(stats.latency_count * p);
+	u64 seen = 0;
+	for (u32 i = 0; i <= LATENCY_BUCKETS; ++i) {
+		seen += stats.latency[i];
+		if (seen > target)
+			return i * 0.1;
+	}
+	return LATENCY_BUCKETS * 0.1;
+}
+
+int main(int argc, char **argv) {
+	int status = -1;
+	u16 port = CHIP8_NET_DEFAULT_PORT;
+	const char *unix_path = NULL;
+	u32 session_count = DEFAULT_SESSIONS;
+	u32 seconds = DEFAULT_SECONDS;
+
+	for (int i = 1; i < argc - 1; i += 2) {
+		if (!strcmp(argv[i], "--port"))
+			port = (u16)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--unix"))
+			unix_path = argv[i + 1];
+		else if (!strcmp(argv[i], "--sessions"))
+			session_count = (u32)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--seconds"))
+			seconds = (u32)atoi(argv[i + 1]);
+	}
+
+	// one descriptor per session
+	struct rlimit limit;
+	if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < session_count + 16) {
+		limit.rlim_cur = limit.rlim_max < session_count + 16 ? limit.rlim_max : session_count + 16;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	client_t *clients = (client_t *)calloc(session_count, sizeof(client_t));
+	if (!clients)
+		PANIC("couldn't allocate clients", failed_alloc);
+
+	int epoll_fd = epoll_create1(0);
+	if (epoll_fd < 0)
+		PANIC("couldn't create epoll instance", failed_epoll);
+
+	srand((u32)time(NULL));
+	u64 start = now_ns();
+
+	for (u32 i = 0; i < session_count; ++i) {
+		client_t *c = &clients[i];
+		c->fd = connect_server(port, unix_path);
+		if (c->fd < 0)
+			PANIC("couldn't connect to server", failed_connect);
+
+		c->next_key = start + (u64)rand() % KEY_INTERVAL_NS;
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = c };
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, c->fd, &ev);
+	}
+
+	// measure from when every session is connected
+	server_stats_t before, after;
+	if (request_server_stats(epoll_fd, &clients[0], &before))
+		PANIC("server didn't answer the stats request", failed_connect);
+
+	start = now_ns();
+	u64 end = start + (u64)seconds * 1000000000ull;
+	memset(&stats.latency, 0, sizeof(stats.latency));
+	stats.latency_count = stats.frames = 0;
+	for (u32 i = 0; i < session_count; ++i)
+		clients[i].frames = 0;
+
+	u64 now;
+	while ((now = now_ns()) < end) {
+		if (poll_clients(epoll_fd, 5))
+			PANIC("server closed the connection", failed_connect);
+
+		now = now_ns();
+		// release the last key and press a new one
+		for (u32 i = 0; i < session_count; ++i) {
+			client_t *c = &clients[i];
+			if (now < c->next_key)
+				continue;
+
+			u8 keys[2] = { c->key, (u8)(CHIP8_NET_KEY_DOWN | (rand() & 0xF)) };
+			c->key = keys[1] & 0xF;
+			send(c->fd, keys, sizeof(keys), MSG_NOSIGNAL | MSG_DONTWAIT);
+			c->next_key = now + KEY_INTERVAL_NS;
+		}
+	}
+
+	double elapsed = (double)(now - start) / 1e9;
+	if (request_server_stats(epoll_fd, &clients[0], &after))
+		PANIC("server didn't answer the stats request", failed_connect);
+
+	/* capacity from the measured cost: worker time per session per tick
+	 * against one frame period. sessions from the server, in case other
+	 * clients are connected too
+	 */
+	u64 ticks = after.ticks - before.ticks;
+	u64 busy_ns = after.busy_ns - before.busy_ns;
+	double frame_ns = 1e9 / CHIP8_NET_FPS;
+	double session_ns = ticks && after.sessions ? (double)busy_ns / ticks / after.sessions : 0.0;
+	double utilisation = ticks && stats.workers ? busy_ns / (ticks * frame_ns * stats.workers) : 0.0;
+	u64 slowest = ~0ull;
+	for (u32 i = 0; i < session_count; ++i) {
+		if (clients[i].frames < slowest)
+			slowest = clients[i].frames;
+	}
+
+	printf("sessions          %u\n", session_count);
+	printf("server workers    %u (%u cycles per frame)\n", stats.workers, stats.cycles);
+	printf("session cost      %.2f us per tick (%llu ticks)\n", session_ns / 1e3, (unsigned long long)ticks);
+	printf("capacity          %.0f sessions per core at %u Hz, workers %.1f%% busy\n",
+		session_ns > 0.0 ? frame_ns / session_ns : 0.0, CHIP8_NET_FPS, utilisation * 100.0);
+	printf("server dropped    %llu frames\n", (unsigned long long)(after.dropped - before.dropped));
+	printf("frames/s          %.0f total, %.1f per session, slowest session %.1f\n",
+		stats.frames / elapsed, stats.frames / elapsed / session_count, slowest / elapsed);
+	printf("bandwidth         %.1f KB/s\n", stats.bytes / elapsed / 1024.0);
+	printf("frame latency     p50 %.1f ms, p99 %.1f ms%s\n", percentile(0.5), percentile(0.99),
+		percentile(0.99) > frame_ns / 1e6 ? " (over the frame budget)" : "");
+	printf("decode errors     %llu\n", (unsigned long long)stats.errors);
+	status = 0;
+
+failed_connect:
+	for (u32 i = 0; i < session_count; ++i) {
+		if (clients[i].fd > 0)
+			close(clients[i].fd);
+	}
+	close(epoll_fd);
+failed_epoll:
+	free(clients);
+failed_alloc:
+	return status;
+}
@@ -0,0 +1,41 @@
+#ifndef CHIP8_NET_H
+#define CHIP8_NET_H
+
+#include "util.h"
+
+/* Wire protocol between chip8-server and its clients, little endian
+ * (read_* / write_* in util.h).
+ *
+ * server -> client, once after connecting:
+ *   hello: u32 magic, u16 version, u16 worker threads, u32 cycles per frame
+ * client -> server, one byte per event:
+ *   keypad event: bit 7 set for key down, low 4 bits the key
+ *   CHIP8_NET_STATS_REQUEST: asks for a stats message
+ * server -> client, every message starts with a u8 type:
+ *   CHIP8_NET_MSG_FRAME, at most once per 60 Hz tick and only if the
+ *   display changed since the last frame the client received:
+ *     u16 payload size, u32 frame number, u64 tick time in ns
+ *     (CLOCK_MONOTONIC), payload: chip8_delta against the previous frame
+ *     sent to this client
+ *   CHIP8_NET_MSG_STATS, totals since the server started:
+ *     u64 ticks, u64 ns the workers spent stepping sessions, u64 frames
+ *     dropped, u32 sessions, u16 workers
+ */
+
+enum {
+	CHIP8_NET_MAGIC = 0x38504843, // "CHP8"
+	CHIP8_NET_VERSION = 2,
+	CHIP8_NET_HELLO_SIZE = 12,
+	CHIP8_NET_FRAME_HEADER_SIZE = 15,
+	CHIP8_NET_STATS_SIZE = 31,
+	CHIP8_NET_KEY_DOWN = 0x80,
+	CHIP8_NET_STATS_REQUEST = 0x40,
+
+	CHIP8_NET_MSG_FRAME = 0,
+	CHIP8_NET_MSG_STATS = 1,
+
+	CHIP8_NET_DEFAULT_PORT = 8088,
+	CHIP8_NET_FPS = 60,
+};
+
+#endif
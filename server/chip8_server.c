@@ -0,0 +1,535 @@
+/* chip8-server: hosts many headless emulator sessions, one per client.
+ * usage: chip8-server <rom> [--port N | --unix PATH] [--workers N] [--cycles N] [--record DIR]
+ *
+ * The main thread runs an epoll loop accepting clients, reading their
+ * keypad events and ticking at 60 Hz. On every tick the sessions are
+ * split between the worker threads, which step them and send the
+ * delta-coded frames (see chip8_net.h). Sessions are only added or
+ * removed by the main thread between ticks.
+ * With --record every session is captured to DIR/session-<id>.c8cap at
+ * the tick rate; the workers only queue the frames, one capture thread
+ * writes every session to disk (see chip8_capture.h).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include "chip8.h"
+#include "chip8_delta.h"
+#include "chip8_capture.h"
+#include "chip8_net.h"
+
+enum {
+	DEFAULT_CYCLES = 5,
+	MAX_WORKERS = 64,
+	MAX_EVENTS = 256,
+	OUT_BUFFER_SIZE = 1024,
+	STATS_INTERVAL = 5 * CHIP8_NET_FPS,
+};
+
+typedef struct {
+	int fd;
+	u32 slot;      // index in server.sessions
+	u8 dead;       // set by a worker when the client went away
+	u8 behind;     // a changed frame was dropped and still has to be sent
+	u32 frame;
+	chip8_t chip8;
+	chip8_capture_t *capture; // with --record
+	u64 sent[CHIP8_DISPLAY_HEIGHT]; // display as last sent to the client
+
+	// bytes not yet accepted by the socket
+	u8 out[OUT_BUFFER_SIZE];
+	u32 out_len;
+} session_t;
+
+typedef struct {
+	pthread_t thread;
+	u32 id;
+	// totals, read by the main thread between ticks
+	u64 frames;
+	u64 bytes;
+	u64 dropped;
+	u64 busy_ns; // time spent stepping sessions
+} worker_t;
+
+static struct {
+	chip8_rom_t *rom;
+	u32 cycles;
+	int listen_fd;
+	int timer_fd;
+	int epoll_fd;
+
+	session_t **sessions;
+	u32 session_count;
+	u32 session_capacity;
+
+	worker_t workers[MAX_WORKERS];
+	u32 worker_count;
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	u32 generation;
+	u32 pending;
+	u64 tick_time;
+	const char *record_dir;
+	u32 next_session_id;
+
+	u64 ticks;
+	u64 tick_ns_total;
+	u64 tick_ns_max;
+	worker_t printed; // worker totals at the last stats line
+} server;
+
+// cleared by SIGINT / SIGTERM, so recordings get closed properly
+static volatile sig_atomic_t running = 1;
+
+static void on_signal(int sig) {
+	(void)sig;
+	running = 0;
+}
+
+// epoll tokens of the non-session file descriptors
+static int listen_token;
+static int timer_token;
+
+static u64 now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+}
+
+// == sessions ================================================
+
+static int flush(session_t *s) {
+	while (s->out_len) {
+		ssize_t sent = send(s->fd, s->out, s->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			s->dead = 1;
+			return -1;
+		}
+		memmove(s->out, s->out + sent, s->out_len - (u32)sent);
+		s->out_len -= (u32)sent;
+	}
+	return 0;
+}
+
+static void step_session(session_t *s, worker_t *w) {
+	if (s->dead)
+		return;
+
+	u32 budget = server.cycles;
+	u32 events = 0;
+	while (budget && !(events & CHIP8_EVENT_FAULT)) {
+		u32 reason;
+		budget -= chip8_run(&s->chip8, budget, &reason);
+		events |= reason;
+	}
+
+	chip8_capture_frame(s->capture, s->chip8.display);
+
+	// the display can only differ from what was sent if it was drawn to
+	// this tick or a previous frame was dropped
+	if (!(events & CHIP8_EVENT_DISPLAY) && !s->behind)
+		return;
+	if (!memcmp(s->sent, s->chip8.display, sizeof(s->sent))) {
+		s->behind = 0;
+		return;
+	}
+
+	// the client is still behind on the previous frames, skip this one,
+	// the next delta is still taken against what it last received
+	if (flush(s) || s->out_len + CHIP8_NET_FRAME_HEADER_SIZE + CHIP8_DELTA_MAX_SIZE > OUT_BUFFER_SIZE) {
+		w->dropped++;
+		s->behind = 1;
+		return;
+	}
+
+	u8 *msg = s->out + s->out_len;
+	u32 size = chip8_delta_encode(s->sent, s->chip8.display, msg + CHIP8_NET_FRAME_HEADER_SIZE);
+	msg[0] = CHIP8_NET_MSG_FRAME;
+	write_u16(msg + 1, (u16)size);
+	write_u32(msg + 3, s->frame++);
+	write_u64(msg + 7, server.tick_time);
+	s->out_len += CHIP8_NET_FRAME_HEADER_SIZE + size;
+	memcpy(s->sent, s->chip8.display, sizeof(s->sent));
+	s->behind = 0;
+
+	w->frames++;
+	w->bytes += CHIP8_NET_FRAME_HEADER_SIZE + size;
+	flush(s);
+}
+
+static void add_session(int fd) {
+	if (server.session_count == server.session_capacity) {
+		u32 capacity = server.session_capacity ? server.session_capacity * 2 : 64;
+		session_t **sessions = (session_t **)realloc(server.sessions, capacity * sizeof(session_t *));
+		if (!sessions)
+			PANIC("couldn't grow session table", failed);
+		server.sessions = sessions;
+		server.session_capacity = capacity;
+	}
+
+	session_t *s = (session_t *)calloc(1, sizeof(session_t));
+	if (!s)
+		PANIC("couldn't allocate session", failed);
+
+	s->fd = fd;
+	chip8_init(&s->chip8);
+	chip8_load_rom(&s->chip8, server.rom);
+
+	u32 id = server.next_session_id++;
+	if (server.record_dir) {
+		char fname[1024];
+		snprintf(fname, sizeof(fname), "%s/session-%u.c8cap", server.record_dir, id);
+		s->capture = chip8_capture_open(fname, CHIP8_NET_FPS);
+	}
+
+	u8 *hello = s->out;
+	write_u32(hello, CHIP8_NET_MAGIC);
+	write_u16(hello + 4, CHIP8_NET_VERSION);
+	write_u16(hello + 6, (u16)server.worker_count);
+	write_u32(hello + 8, server.cycles);
+	s->out_len = CHIP8_NET_HELLO_SIZE;
+
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+	if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev)) {
+		chip8_capture_close(s->capture);
+		chip8_cleanup(&s->chip8);
+		free(s);
+		PANIC("couldn't watch client socket", failed);
+	}
+
+	s->slot = server.session_count;
+	server.sessions[server.session_count++] = s;
+	flush(s);
+	return;
+
+failed:
+	close(fd);
+}
+
+// sums the worker totals
+static worker_t worker_totals(void) {
+	worker_t total = { 0 };
+	for (u32 i = 0; i < server.worker_count; ++i) {
+		total.frames += server.workers[i].frames;
+		total.bytes += server.workers[i].bytes;
+		total.dropped += server.workers[i].dropped;
+		total.busy_ns += server.workers[i].busy_ns;
+	}
+	return total;
+}
+
+// queues the server totals, called by the main thread between ticks
+static void send_stats(session_t *s) {
+	if (s->out_len + CHIP8_NET_STATS_SIZE > OUT_BUFFER_SIZE)
+		return;
+
+	worker_t total = worker_totals();
+	u8 *msg = s->out + s->out_len;
+	msg[0] = CHIP8_NET_MSG_STATS;
+	write_u64(msg + 1, server.ticks);
+	write_u64(msg + 9, total.busy_ns);
+	write_u64(msg + 17, total.dropped);
+	write_u32(msg + 25, server.session_count);
+	write_u16(msg + 29, (u16)server.worker_count);
+	s->out_len += CHIP8_NET_STATS_SIZE;
+	flush(s);
+}
+
+static void remove_session(session_t *s) {
+	session_t *last = server.sessions[--server.session_count];
+	server.sessions[s->slot] = last;
+	last->slot = s->slot;
+
+	epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+	close(s->fd);
+	chip8_capture_close(s->capture);
+	chip8_cleanup(&s->chip8);
+	free(s);
+}
+
+static void read_input(session_t *s) {
+	u8 buf[256];
+	ssize_t received;
+
+	while ((received = recv(s->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for (ssize_t i = 0; i < received; ++i) {
+			if (buf[i] == CHIP8_NET_STATS_REQUEST)
+				send_stats(s);
+			else
+				chip8_input(&s->chip8, buf[i] & 0xF, (buf[i] & CHIP8_NET_KEY_DOWN) != 0);
+		}
+	}
+
+	if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+		// stop polling it, the session is removed after the next tick
+		epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, s->fd, NULL);
+		s->dead = 1;
+	}
+}
+
+// == workers =================================================
+
+static void *worker_thread(void *arg) {
+	worker_t *w = (worker_t *)arg;
+	u32 seen = 0;
+
+	for (;;) {
+		pthread_mutex_lock(&server.mutex);
+		while (server.generation == seen)
+			pthread_cond_wait(&server.start, &server.mutex);
+		seen = server.generation;
+		pthread_mutex_unlock(&server.mutex);
+
+		// contiguous share of the sessions
+		u64 start = now_ns();
+		u32 first = (u32)((u64)server.session_count * w->id / server.worker_count);
+		u32 last = (u32)((u64)server.session_count * (w->id + 1) / server.worker_count);
+		for (u32 i = first; i < last; ++i)
+			step_session(server.sessions[i], w);
+		w->busy_ns += now_ns() - start;
+
+		pthread_mutex_lock(&server.mutex);
+		if (--server.pending == 0)
+			pthread_cond_signal(&server.done);
+		pthread_mutex_unlock(&server.mutex);
+	}
+
+	return NULL;
+}
+
+static void tick(void) {
+	u64 start = now_ns();
+	server.tick_time = start;
+
+	pthread_mutex_lock(&server.mutex);
+	server.generation++;
+	server.pending = server.worker_count;
+	pthread_cond_broadcast(&server.start);
+	while (server.pending)
+		pthread_cond_wait(&server.done, &server.mutex);
+	pthread_mutex_unlock(&server.mutex);
+
+	for (u32 i = 0; i < server.session_count; ) {
+		if (server.sessions[i]->dead)
+			remove_session(server.sessions[i]);
+		else
+			++i;
+	}
+
+	u64 elapsed = now_ns() - start;
+	server.ticks++;
+	server.tick_ns_total += elapsed;
+	if (elapsed > server.tick_ns_max)
+		server.tick_ns_max = elapsed;
+
+	if (server.ticks % STATS_INTERVAL == 0) {
+		worker_t total = worker_totals();
+		u64 frames = total.frames - server.printed.frames;
+		u64 bytes = total.bytes - server.printed.bytes;
+		u64 dropped = total.dropped - server.printed.dropped;
+		server.printed = total;
+
+		printf("sessions %u  frames/s %.0f  KB/s %.1f  dropped %llu  tick avg %.3f ms max %.3f ms\n",
+			server.session_count,
+			(double)frames / (STATS_INTERVAL / CHIP8_NET_FPS),
+			(double)bytes / 1024.0 / (STATS_INTERVAL / CHIP8_NET_FPS),
+			(unsigned long long)dropped,
+			(double)server.tick_ns_total / STATS_INTERVAL / 1e6,
+			(double)server.tick_ns_max / 1e6);
+		fflush(stdout);
+		server.tick_ns_total = server.tick_ns_max = 0;
+	}
+}
+
+// == setup ===================================================
+
+static int open_listener(u16 port, const char *unix_path) {
+	int fd = -1;
+
+	if (unix_path) {
+		struct sockaddr_un addr = { .sun_family = AF_UNIX };
+		if (strlen(unix_path) >= sizeof(addr.sun_path))
+			PANIC("unix socket path too long", failed);
+		strcpy(addr.sun_path, unix_path);
+		unlink(unix_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+			PANIC("couldn't bind unix socket", failed_bind);
+	}
+	else {
+		struct sockaddr_in addr = {
+			.sin_family = AF_INET,
+			.sin_port = htons(port),
+			.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+		};
+		int yes = 1;
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+			PANIC("couldn't bind tcp socket", failed_bind);
+	}
+
+	if (listen(fd, SOMAXCONN))
+		PANIC("couldn't listen", failed_bind);
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+
+failed_bind:
+	if (fd >= 0)
+		close(fd);
+failed:
+	return -1;
+}
+
+static void accept_clients(void) {
+	int fd;
+	while ((fd = accept(server.listen_fd, NULL, NULL)) >= 0) {
+		int yes = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		add_session(fd);
+	}
+}
+
+int main(int argc, char **argv) {
+	int status = -1;
+	u16 port = CHIP8_NET_DEFAULT_PORT;
+	const char *unix_path = NULL;
+
+	if (argc < 2) {
+		printf("usage: %s <rom> [--port N | --unix PATH] [--workers N] [--cycles N] [--record DIR]\n", argv[0]);
+		return status;
+	}
+
+	server.cycles = DEFAULT_CYCLES;
+	server.worker_count = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+
+	for (int i = 2; i < argc - 1; i += 2) {
+		if (!strcmp(argv[i], "--port"))
+			port = (u16)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--unix"))
+			unix_path = argv[i + 1];
+		else if (!strcmp(argv[i], "--workers"))
+			server.worker_count = (u32)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--cycles"))
+			server.cycles = (u32)atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "--record"))
+			server.record_dir = argv[i + 1];
+	}
+
+	if (server.worker_count < 1)
+		server.worker_count = 1;
+	if (server.worker_count > MAX_WORKERS)
+		server.worker_count = MAX_WORKERS;
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	// every session shares the ROM pages
+	server.rom = chip8_rom_load(argv[1]);
+	if (!server.rom)
+		PANIC("couldn't load ROM", failed_rom);
+
+	server.listen_fd = open_listener(port, unix_path);
+	if (server.listen_fd < 0)
+		PANIC("couldn't open listening socket", failed_listen);
+
+	server.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+	struct itimerspec interval = {
+		.it_interval = { 0, 1000000000 / CHIP8_NET_FPS },
+		.it_value = { 0, 1000000000 / CHIP8_NET_FPS },
+	};
+	if (server.timer_fd < 0 || timerfd_settime(server.timer_fd, 0, &interval, NULL))
+		PANIC("couldn't create tick timer", failed_timer);
+
+	server.epoll_fd = epoll_create1(0);
+	struct epoll_event listen_ev = { .events = EPOLLIN, .data.ptr = &listen_token };
+	struct epoll_event timer_ev = { .events = EPOLLIN, .data.ptr = &timer_token };
+	if (server.epoll_fd < 0 ||
+		epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_ev) ||
+		epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.timer_fd, &timer_ev))
+		PANIC("couldn't create epoll instance", failed_epoll);
+
+	pthread_mutex_init(&server.mutex, NULL);
+	pthread_cond_init(&server.start, NULL);
+	pthread_cond_init(&server.done, NULL);
+	for (u32 i = 0; i < server.worker_count; ++i) {
+		server.workers[i].id = i;
+		if (pthread_create(&server.workers[i].thread, NULL, worker_thread, &server.workers[i]))
+			PANIC("couldn't start worker", failed_epoll);
+	}
+
+	if (unix_path)
+		printf("listening on %s, %u workers, %u cycles per frame\n", unix_path, server.worker_count, server.cycles);
+	else
+		printf("listening on 127.0.0.1:%u, %u workers, %u cycles per frame\n", port, server.worker_count, server.cycles);
+	fflush(stdout);
+
+	while (running) {
+		struct epoll_event events[MAX_EVENTS];
+		int count = epoll_wait(server.epoll_fd, events, MAX_EVENTS, -1);
+		if (count < 0 && errno != EINTR)
+			PANIC("epoll_wait failed", failed_epoll);
+
+		// the tick runs after the batch, as it can free sessions
+		// referenced by later events
+		u8 run_tick = 0;
+
+		for (int i = 0; i < count; ++i) {
+			void *token = events[i].data.ptr;
+			if (token == &listen_token) {
+				accept_clients();
+			}
+			else if (token == &timer_token) {
+				u64 expirations;
+				if (read(server.timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+					run_tick = 1;
+			}
+			else {
+				read_input((session_t *)token);
+			}
+		}
+
+		if (run_tick)
+			tick();
+	}
+
+	// the workers are idle between ticks
+	while (server.session_count)
+		remove_session(server.sessions[0]);
+	chip8_capture_shutdown();
+	free(server.sessions);
+	status = 0;
+
+failed_epoll:
+	close(server.timer_fd);
+failed_timer:
+	close(server.listen_fd);
+failed_listen:
+	chip8_rom_release(server.rom);
+failed_rom:
+	return status;
+}
@@ -1,63 +1,68 @@
 #include "chip8.h"
 #include "chip8_font.h"
+#include "chip8_trace.h"
+#include "chip8_debug.h"
+#include "util.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <time.h>
-#include <sokol/sokol.h>
 
 //#define USE_ORIGINAL
 
 enum {
 	START_ADDRESS = 0x200,
 	FONTSET_START_ADDRESS = 0x50,
-	DISPLAY_WIDTH = 64,
-	DISPLAY_HEIGHT = 32,
+	MAX_ROM_SIZE = CHIP8_MEMORY_SIZE - START_ADDRESS,
 };
 
-typedef void (*chip8_func)(void);
+typedef void (*chip8_func)(chip8_t *c);
 
-typedef struct {
-	u8 registers[16];
-	u8 memory[4096];
-	u16 index;
-	u16 pc;
-	u16 stack[16];
-	u8 sp;
-	u8 delay_timer;
-	u8 sound_timer;
-	u8 keypad[16];
-	u16 opcode;
-	chip8_func table[0xf + 1];
-	chip8_func table_0[0xe + 1];
-	chip8_func table_8[0xe + 1];
-	chip8_func table_e[0xe + 1];
-	chip8_func table_f[0x65 + 1];
+struct chip8_rom_t {
+	u32 refs;
+	const u8 *pages[CHIP8_PAGE_COUNT];
+	// only the pages holding the font and the program are stored,
+	// every other page points to zero_page
+	u8 data[];
+};
+
+// memory accesses are only reported while the debugger is armed
+#define WATCH_READ(c, addr)  do { if ((c)->debug_armed) chip8_debug_on_read(c, addr);  } while(0)
+#define WATCH_WRITE(c, addr) do { if ((c)->debug_armed) chip8_debug_on_write(c, addr); } while(0)
 
-	//u32 display[DISPLAY_WIDTH * DISPLAY_HEIGHT];
-	u32 display[DISPLAY_HEIGHT][DISPLAY_WIDTH];
+static const u8 zero_page[CHIP8_PAGE_SIZE];
 
-	// sokol stuff
-	sg_image sokol_img;
-} chip8_t;
+// terms of the state hash, XORed in and out as values change
+static inline u64 hash_mix(u64 x) {
+	// splitmix64 finalizer
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
 
-#define PANIC(msg, tag) do { puts("ERROR: " msg "\n"); goto tag; } while(0)
+static inline u64 hash_byte(u16 address, u8 value) {
+	return hash_mix(((u64)address << 8) | value);
+}
 
-static chip8_t chip8;
+static inline u64 hash_row(u8 y, u64 row) {
+	return hash_mix(row + (y + 1) * 0x9e3779b97f4a7c15ull);
+}
 
-static inline void update_screen(void);
-static inline u8 random_byte();
+static inline u8 random_byte(chip8_t *c);
 
 /* INSTRUCTIONS */
 
-static inline void goto_table_0(void);
-static inline void goto_table_8(void);
-static inline void goto_table_e(void);
-static inline void goto_table_f(void);
+static inline void goto_table_0(chip8_t *c);
+static inline void goto_table_8(chip8_t *c);
+static inline void goto_table_e(chip8_t *c);
+static inline void goto_table_f(chip8_t *c);
 
-#define DEFINE_OPERATION(name) static inline void name (void)
+#define DEFINE_OPERATION(name) static inline void name (chip8_t *c)
 
 DEFINE_OPERATION(OP_NULL);   // not yet defined
 
@@ -103,102 +108,142 @@ DEFINE_OPERATION(LD_Fx65);	 // read registers V0 to Vx in memory starting at loc
 
 /****************/
 
-#define ARR_SIZE(arr) sizeof(arr) / sizeof(arr[0])
+// function pointer tables, shared by every instance,
+// missing entries are treated as OP_NULL
+static const chip8_func table[0xf + 1] = {
+	[0x0] = goto_table_0,
+
+	[0x1] = JP_1nnn,
+	[0x2] = CALL_2nnn,
+	[0x3] = SE_3xkk,
+	[0x4] = SNE_4xkk,
+	[0x5] = SE_5xy0,
+	[0x6] = LD_6xkk,
+	[0x7] = ADD_7xkk,
+	[0x8] = goto_table_8,
+	[0x9] = SNE_9xy0,
+
+	[0xa] = LD_Annn,
+	[0xb] = JP_Bnnn,
+	[0xc] = RND_Cxkk,
+	[0xd] = DRW_Dxyn,
+	[0xe] = goto_table_e,
+	[0xf] = goto_table_f,
+};
 
-void chip8_init() {
-	chip8 = (chip8_t){
-		.pc = START_ADDRESS,
-	};
-	
-	memcpy(&chip8.memory[FONTSET_START_ADDRESS], fontset, FONTSET_SIZE);
-	
-	// clear the screen
-	CLS_00E0();
-
-	// Chip8 display init
-	chip8.sokol_img = sg_make_image(&(sg_image_desc) {
-		.width = DISPLAY_WIDTH,
-		.height = DISPLAY_HEIGHT,
-		.pixel_format = SG_PIXELFORMAT_RGBA8,
-		.usage = SG_USAGE_DYNAMIC
-	});
-
-	// initialize function pointer table
-	// table
-	for (int i = 0; i < ARR_SIZE(chip8.table); ++i)
-		chip8.table[i] = OP_NULL;
-	// table 0x00xx
-	for(int i = 0; i < ARR_SIZE(chip8.table_0); ++i)
-		chip8.table_0[i] = OP_NULL;
-	// table 0x8xxx
-	for(int i = 0; i < ARR_SIZE(chip8.table_8); ++i)
-		chip8.table_8[i] = OP_NULL;
-	// table 0xExxx
-	for(int i = 0; i < ARR_SIZE(chip8.table_e); ++i)
-		chip8.table_e[i] = OP_NULL;
-	// table 0xFxxx
-	for(int i = 0; i < ARR_SIZE(chip8.table_f); ++i)
-		chip8.table_f[i] = OP_NULL;
-
-	chip8.table[0x0] = goto_table_0;
-
-	chip8.table[0x1] = JP_1nnn;
-	chip8.table[0x2] = CALL_2nnn;
-	chip8.table[0x3] = SE_3xkk;
-	chip8.table[0x4] = SNE_4xkk;
-	chip8.table[0x5] = SE_5xy0;
-	chip8.table[0x6] = LD_6xkk;
-	chip8.table[0x7] = ADD_7xkk;
-	chip8.table[0x8] = goto_table_8;
-	chip8.table[0x9] = SNE_9xy0;
-
-	chip8.table[0xa] = LD_Annn;
-	chip8.table[0xb] = JP_Bnnn;
-	chip8.table[0xc] = RND_Cxkk;
-	chip8.table[0xd] = DRW_Dxyn;
-	chip8.table[0xe] = goto_table_e;
-	chip8.table[0xf] = goto_table_f;
-
-	chip8.table_0[0x0] = CLS_00E0;
-	chip8.table_0[0xE] = RET_00EE;
-
-	chip8.table_8[0x0] = LD_8xy0;
-	chip8.table_8[0x1] = OR_8xy1;
-	chip8.table_8[0x2] = AND_8xy2;
-	chip8.table_8[0x3] = XOR_8xy3;
-	chip8.table_8[0x4] = ADD_8xy4;
-	chip8.table_8[0x5] = SUB_8xy5;
-	chip8.table_8[0x6] = SHR_8xy6;
-	chip8.table_8[0x7] = SUBN_8xy7;
-	chip8.table_8[0xE] = SHL_8xyE;
-
-	chip8.table_e[0xE] = SKP_Ex9E;
-	chip8.table_e[0x1] = SKNP_ExA1;
-
-	chip8.table_f[0x07] = LD_Fx07;
-	chip8.table_f[0x0a] = LD_Fx0a;
-	chip8.table_f[0x15] = LD_Fx15;
-	chip8.table_f[0x18] = LD_Fx18;
-	chip8.table_f[0x1e] = ADD_Fx1E;
-	chip8.table_f[0x29] = LD_Fx29;
-	chip8.table_f[0x33] = LD_Fx33;
-	chip8.table_f[0x55] = LD_Fx55;
-	chip8.table_f[0x65] = LD_Fx65;
-
-	srand((u32)time(NULL));
-}
-
-int  chip8_load_data(void *data, u32 size) {
-	int status = -1;
+// table 0x00xx
+static const chip8_func table_0[0xf + 1] = {
+	[0x0] = CLS_00E0,
+	[0xE] = RET_00EE,
+};
 
-	memcpy(&chip8.memory[START_ADDRESS], data, size);
-	status = 0;
-	
-	return status;
+// table 0x8xxx
+static const chip8_func table_8[0xf + 1] = {
+	[0x0] = LD_8xy0,
+	[0x1] = OR_8xy1,
+	[0x2] = AND_8xy2,
+	[0x3] = XOR_8xy3,
+	[0x4] = ADD_8xy4,
+	[0x5] = SUB_8xy5,
+	[0x6] = SHR_8xy6,
+	[0x7] = SUBN_8xy7,
+	[0xE] = SHL_8xyE,
+};
+
+// table 0xExxx
+static const chip8_func table_e[0xf + 1] = {
+	[0xE] = SKP_Ex9E,
+	[0x1] = SKNP_ExA1,
+};
+
+// table 0xFxxx
+static const chip8_func table_f[0xff + 1] = {
+	[0x07] = LD_Fx07,
+	[0x0a] = LD_Fx0a,
+	[0x15] = LD_Fx15,
+	[0x18] = LD_Fx18,
+	[0x1e] = ADD_Fx1E,
+	[0x29] = LD_Fx29,
+	[0x33] = LD_Fx33,
+	[0x55] = LD_Fx55,
+	[0x65] = LD_Fx65,
+};
+
+// == MEMORY ==================================================
+
+static inline u8 mem_read(const chip8_t *c, u16 address) {
+	address &= CHIP8_MEMORY_SIZE - 1;
+	return c->pages[address / CHIP8_PAGE_SIZE][address % CHIP8_PAGE_SIZE];
 }
 
-int chip8_load_file(const char *fname) {
-	int status = -1;
+static inline void mem_write(chip8_t *c, u16 address, u8 value) {
+	address &= CHIP8_MEMORY_SIZE - 1;
+	u16 page = address / CHIP8_PAGE_SIZE;
+
+	// copy on write
+	if (!(c->private_pages & (1 << page))) {
+		u8 *copy = (u8 *)malloc(CHIP8_PAGE_SIZE);
+		if (!copy) {
+			// dropping the write would leave the guest running on
+			// corrupted state, halt it like an undefined opcode
+			puts("ERROR: couldn't allocate memory page\n");
+			c->faulted = 1;
+			c->events |= CHIP8_EVENT_FAULT;
+			return;
+		}
+		memcpy(copy, c->pages[page], CHIP8_PAGE_SIZE);
+		c->pages[page] = copy;
+		c->private_pages |= 1 << page;
+	}
+
+	u8 *byte = &((u8 *)c->pages[page])[address % CHIP8_PAGE_SIZE];
+	if (c->hash_armed)
+		c->state_hash ^= hash_byte(address, *byte) ^ hash_byte(address, value);
+	*byte = value;
+}
+
+static void free_pages(chip8_t *c) {
+	for (u16 page = 0; page < CHIP8_PAGE_COUNT; ++page) {
+		if (c->private_pages & (1 << page))
+			free((u8 *)c->pages[page]);
+		c->pages[page] = c->rom ? c->rom->pages[page] : zero_page;
+	}
+	c->private_pages = 0;
+}
+
+// == ROM =====================================================
+
+chip8_rom_t *chip8_rom_create(const void *data, u32 size) {
+	chip8_rom_t *rom = NULL;
+
+	if (size > MAX_ROM_SIZE)
+		PANIC("ROM doesn't fit in memory", failed_size);
+
+	// the font page plus every page touched by the program
+	u32 first_page = START_ADDRESS / CHIP8_PAGE_SIZE;
+	u32 last_page = (START_ADDRESS + size + CHIP8_PAGE_SIZE - 1) / CHIP8_PAGE_SIZE;
+	u32 stored_pages = 1 + (last_page - first_page);
+
+	rom = (chip8_rom_t *)calloc(1, sizeof(chip8_rom_t) + stored_pages * CHIP8_PAGE_SIZE);
+	if (!rom)
+		PANIC("couldn't allocate ROM", failed_size);
+
+	rom->refs = 1;
+	memcpy(&rom->data[FONTSET_START_ADDRESS], fontset, FONTSET_SIZE);
+	memcpy(&rom->data[CHIP8_PAGE_SIZE], data, size);
+
+	for (u32 page = 0; page < CHIP8_PAGE_COUNT; ++page)
+		rom->pages[page] = zero_page;
+	rom->pages[0] = rom->data;
+	for (u32 page = first_page; page < last_page; ++page)
+		rom->pages[page] = &rom->data[(1 + page - first_page) * CHIP8_PAGE_SIZE];
+
+failed_size:
+	return rom;
+}
+
+chip8_rom_t *chip8_rom_load(const char *fname) {
+	chip8_rom_t *rom = NULL;
 
 	FILE *f = fopen(fname, "rb");
 	if (!f)
@@ -219,324 +264,509 @@ int chip8_load_file(const char *fname) {
 	if (items_read != 1)
 		PANIC("EOF reached before reading whole file", failed_fread);
 
-	// load the ROM contents into chip8's memory
-	memcpy(&chip8.memory[START_ADDRESS], buf, fsize);
-
-	status = 0;
+	rom = chip8_rom_create(buf, (u32)fsize);
 
 failed_fread:
 	free(buf);
 failed_malloc:
 	fclose(f);
 failed_open:
+	return rom;
+}
+
+void chip8_rom_acquire(chip8_rom_t *rom) {
+	rom->refs++;
+}
+
+void chip8_rom_release(chip8_rom_t *rom) {
+	if (rom && --rom->refs == 0)
+		free(rom);
+}
+
+// == API =====================================================
+
+void chip8_init(chip8_t *c) {
+	*c = (chip8_t){
+		.pc = START_ADDRESS,
+	};
+
+	// clear the screen
+	CLS_00E0(c);
+
+	chip8_seed(c, (u32)time(NULL));
+}
+
+int chip8_load_rom(chip8_t *c, chip8_rom_t *rom) {
+	free_pages(c);
+
+	chip8_rom_acquire(rom);
+	chip8_rom_release(c->rom);
+	c->rom = rom;
+
+	for (u16 page = 0; page < CHIP8_PAGE_COUNT; ++page)
+		c->pages[page] = rom->pages[page];
+
+	if (c->hash_armed)
+		chip8_hash_enable(c);
+
+	return 0;
+}
+
+int chip8_load_data(chip8_t *c, const void *data, u32 size) {
+	int status = -1;
+
+	chip8_rom_t *rom = chip8_rom_create(data, size);
+	if (!rom)
+		PANIC("couldn't create ROM", failed_rom);
+
+	status = chip8_load_rom(c, rom);
+	chip8_rom_release(rom);
+
+failed_rom:
 	return status;
 }
 
-void chip8_update() {
+int chip8_load_file(chip8_t *c, const char *fname) {
+	int status = -1;
+
+	chip8_rom_t *rom = chip8_rom_load(fname);
+	if (!rom)
+		PANIC("couldn't load ROM file", failed_rom);
+
+	status = chip8_load_rom(c, rom);
+	chip8_rom_release(rom);
+
+failed_rom:
+	return status;
+}
+
+// returns 1 if an instruction was executed
+static inline int step(chip8_t *c) {
+	u16 pc = c->pc;
+	u8 debug_armed = c->debug_armed;
+	u8 sounding = c->sound_timer != 0;
+
+	if (c->faulted) {
+		c->events |= CHIP8_EVENT_FAULT;
+		return 0;
+	}
+
+	if (debug_armed) {
+		if (chip8_debug_before_step(c)) {
+			c->events |= CHIP8_EVENT_BREAK;
+			return 0;
+		}
+	}
+
 	// fetch
-	chip8.opcode = (chip8.memory[chip8.pc] << 8) | chip8.memory[chip8.pc + 1];
-	chip8.pc += 2;
+	c->opcode = (mem_read(c, pc) << 8) | mem_read(c, pc + 1);
+	c->pc += 2;
 
 	// decode
 	// get the upper 4 bits
-	u8 decoded = (chip8.opcode & 0xF000U) >> 12;
-#ifndef NDEBUG
-	printf("instruction [%02x]\n", chip8.opcode);
-#endif
+	u8 decoded = (c->opcode & 0xF000U) >> 12;
 
 	// execute
-	chip8.table[decoded]();
+	table[decoded](c);
+
+	// stop on the faulting instruction: no trace entry, no timer tick
+	// and it isn't counted
+	if (c->faulted) {
+		c->pc = pc;
+		return 0;
+	}
+
+	if (c->trace)
+		chip8_trace_record(c->trace, pc, c->opcode, c->index,
+			c->registers[(c->opcode & 0x0F00) >> 8], c->registers[0xF]);
+
+	if (debug_armed) {
+		chip8_debug_after_step(c, pc);
+		if (chip8_debug_state(c) != CHIP8_DEBUG_RUNNING)
+			c->events |= CHIP8_EVENT_BREAK;
+	}
+
+	if (c->delay_timer > 0)
+		c->delay_timer--;
 
-	if (chip8.delay_timer > 0)
-		chip8.delay_timer--;
+	if (c->sound_timer > 0)
+		c->sound_timer--;
 
-	if (chip8.sound_timer > 0)
-		chip8.sound_timer--;
+	if ((c->sound_timer != 0) != sounding)
+		c->events |= CHIP8_EVENT_SOUND;
+
+	return 1;
+}
+
+void chip8_update(chip8_t *c) {
+	c->events = 0;
+	c->instructions += step(c);
+}
+
+u32 chip8_run(chip8_t *c, u32 max_cycles, u32 *exit_reason) {
+	u32 cycles = 0;
+
+	c->events = 0;
+	while (cycles < max_cycles && !c->events)
+		cycles += step(c);
+	c->instructions += cycles;
+
+	if (exit_reason)
+		*exit_reason = c->events;
+	return cycles;
 }
 
-void chip8_input(const sapp_event *e) {
-	if (e->type == SAPP_EVENTTYPE_KEY_DOWN || e->type == SAPP_EVENTTYPE_KEY_UP) {
-		u8 is_down = e->type == SAPP_EVENTTYPE_KEY_DOWN;
-		switch (e->key_code) {
-		case SAPP_KEYCODE_X: chip8.keypad[0] = is_down; break;
-		case SAPP_KEYCODE_1: chip8.keypad[1] = is_down; break;
-		case SAPP_KEYCODE_2: chip8.keypad[2] = is_down; break;
-		case SAPP_KEYCODE_3: chip8.keypad[3] = is_down; break;
+void chip8_input(chip8_t *c, u8 key, u8 is_down) {
+	u16 bit = 1 << (key & 0xF);
+	if (is_down)
+		c->keypad |= bit;
+	else
+		c->keypad &= ~bit;
+}
+
+void chip8_cleanup(chip8_t *c) {
+	chip8_debug_detach(c);
+	chip8_rom_release(c->rom);
+	c->rom = NULL;
+	free_pages(c);
+}
+
+void chip8_seed(chip8_t *c, u32 seed) {
+	// xorshift state must not be 0
+	c->rng = seed ? seed : 0x2545F491;
+}
+
+void chip8_get_cpu_state(const chip8_t *c, chip8_cpu_state_t *state) {
+	memcpy(state->registers, c->registers, sizeof(state->registers));
+	memcpy(state->stack, c->stack, sizeof(state->stack));
+	state->index = c->index;
+	state->pc = c->pc;
+	state->sp = c->sp;
+	state->delay_timer = c->delay_timer;
+	state->sound_timer = c->sound_timer;
+	state->opcode = c->opcode;
+}
 
-		case SAPP_KEYCODE_Q: chip8.keypad[4] = is_down; break;
-		case SAPP_KEYCODE_W: chip8.keypad[5] = is_down; break;
-		case SAPP_KEYCODE_E: chip8.keypad[6] = is_down; break;
+u8 chip8_peek(const chip8_t *c, u16 address) {
+	return mem_read(c, address);
+}
 
-		case SAPP_KEYCODE_A: chip8.keypad[7] = is_down; break;
-		case SAPP_KEYCODE_S: chip8.keypad[8] = is_down; break;
-		case SAPP_KEYCODE_D: chip8.keypad[9] = is_down; break;
+int chip8_clone(chip8_t *dst, const chip8_t *src) {
+	*dst = *src;
+	dst->trace = NULL;
+	dst->debug = NULL;
+	dst->debug_armed = 0;
 
-		case SAPP_KEYCODE_Z: chip8.keypad[10] = is_down; break;
-		case SAPP_KEYCODE_C: chip8.keypad[11] = is_down; break;
+	if (dst->rom)
+		chip8_rom_acquire(dst->rom);
 
-		case SAPP_KEYCODE_4: chip8.keypad[12] = is_down; break;
-		case SAPP_KEYCODE_R: chip8.keypad[13] = is_down; break;
-		case SAPP_KEYCODE_F: chip8.keypad[14] = is_down; break;
-		case SAPP_KEYCODE_V: chip8.keypad[15] = is_down; break;
+	for (u16 page = 0; page < CHIP8_PAGE_COUNT; ++page) {
+		if (!(src->private_pages & (1 << page)))
+			continue;
 
-		default: break;
+		u8 *copy = (u8 *)malloc(CHIP8_PAGE_SIZE);
+		if (!copy) {
+			// the pages not copied yet are still shared with src
+			dst->private_pages &= (1 << page) - 1;
+			PANIC("couldn't allocate memory page", failed_page);
 		}
+		memcpy(copy, src->pages[page], CHIP8_PAGE_SIZE);
+		dst->pages[page] = copy;
 	}
+
+	return 0;
+
+failed_page:
+	chip8_cleanup(dst);
+	return -1;
 }
 
-void chip8_render() {
-	update_screen();
+u32 chip8_footprint(const chip8_t *c) {
+	u32 pages = 0;
+	for (u16 mask = c->private_pages; mask; mask &= mask - 1)
+		pages++;
+	return sizeof(chip8_t) + pages * CHIP8_PAGE_SIZE;
+}
 
-	sgl_enable_texture();
-	sgl_texture(chip8.sokol_img);
+// == STATE HASH ==============================================
 
-	sgl_push_matrix();
-		sgl_scale(0.75f, 0.75f, 1.f);
-		sgl_begin_quads();
-			sgl_v2f_t2f(-1.f, -1.f, 0.f, 1.f);
-			sgl_v2f_t2f(-1.f,  1.f, 0.f, 0.f);
-			sgl_v2f_t2f( 1.f,  1.f, 1.f, 0.f);
-			sgl_v2f_t2f( 1.f, -1.f, 1.f, 1.f);
-		sgl_end();
-	sgl_pop_matrix();
+// memory and display part of the hash, computed from scratch
+static u64 hash_memory_display(const chip8_t *c) {
+	u64 hash = 0;
+	for (u16 address = 0; address < CHIP8_MEMORY_SIZE; ++address)
+		hash ^= hash_byte(address, mem_read(c, address));
+	for (u8 y = 0; y < CHIP8_DISPLAY_HEIGHT; ++y)
+		hash ^= hash_row(y, c->display[y]);
+	return hash;
 }
 
-void chip8_cleanup() {
+void chip8_hash_enable(chip8_t *c) {
+	c->hash_armed = 1;
+	c->state_hash = hash_memory_display(c);
+}
+
+u64 chip8_state_hash(const chip8_t *c) {
+	u64 hash = c->state_hash;
 
+	for (u8 i = 0; i < 16; ++i)
+		hash = hash_mix(hash ^ c->registers[i] ^ ((u64)c->stack[i] << 8) ^ ((u64)i << 24));
+	hash = hash_mix(hash ^ c->index ^ ((u64)c->pc << 16) ^ ((u64)c->sp << 32));
+	hash = hash_mix(hash ^ c->delay_timer ^ ((u64)c->sound_timer << 8) ^ ((u64)c->faulted << 16) ^ ((u64)c->rng << 32));
+	return hash;
 }
 
-static inline void update_screen(void) {
-	sg_update_image(chip8.sokol_img, &(sg_image_data) {
-		.subimage[0][0] = {
-			.ptr = chip8.display,
-			.size = DISPLAY_WIDTH * DISPLAY_HEIGHT
-		}
-	});
+u64 chip8_state_hash_full(const chip8_t *c) {
+	chip8_t copy = *c;
+	copy.state_hash = hash_memory_display(c);
+	return chip8_state_hash(&copy);
+}
+
+static inline u8 random_byte(chip8_t *c) {
+	// xorshift32, per instance so sessions don't share state
+	c->rng ^= c->rng << 13;
+	c->rng ^= c->rng >> 17;
+	c->rng ^= c->rng << 5;
+	return (u8)(c->rng >> 24);
 }
 
 // == GOTO TABLE ============================================
 
-inline void goto_table_0(void) {
-	chip8.table_0[chip8.opcode & 0x000F]();
+// unlike the main table these are indexed by opcode bits that
+// can select missing entries
+inline void goto_table_0(chip8_t *c) {
+	chip8_func op = table_0[c->opcode & 0x000F];
+	(op ? op : OP_NULL)(c);
 }
 
-inline void goto_table_8(void) {
-	chip8.table_8[chip8.opcode & 0x000F]();
+inline void goto_table_8(chip8_t *c) {
+	chip8_func op = table_8[c->opcode & 0x000F];
+	(op ? op : OP_NULL)(c);
 }
 
-inline void goto_table_e(void) {
-	chip8.table_e[chip8.opcode & 0x000F]();
+inline void goto_table_e(chip8_t *c) {
+	chip8_func op = table_e[c->opcode & 0x000F];
+	(op ? op : OP_NULL)(c);
 }
 
-inline void goto_table_f(void) {
-	chip8.table_f[chip8.opcode & 0x00FF]();
+inline void goto_table_f(chip8_t *c) {
+	chip8_func op = table_f[c->opcode & 0x00FF];
+	(op ? op : OP_NULL)(c);
 }
 
 // == INSTRUCTIONS ============================================
 
-void OP_NULL(void) {
-	printf("this operations hasn't been defined yet %02x\n", chip8.opcode);
-	exit(-1);
+void OP_NULL(chip8_t *c) {
+	printf("this operations hasn't been defined yet %02x at %03x\n", c->opcode, c->pc - 2);
+
+	// halt this instance instead of taking the whole process (and
+	// every other instance) down
+	c->faulted = 1;
+	c->events |= CHIP8_EVENT_FAULT;
 }
 
-void CLS_00E0(void) {
-	memset(chip8.display, 0x00, sizeof(u32) * DISPLAY_WIDTH * DISPLAY_HEIGHT);
+void CLS_00E0(chip8_t *c) {
+	if (c->hash_armed) {
+		for (u8 y = 0; y < CHIP8_DISPLAY_HEIGHT; ++y)
+			c->state_hash ^= hash_row(y, c->display[y]) ^ hash_row(y, 0);
+	}
+	memset(c->display, 0x00, sizeof(c->display));
+	c->events |= CHIP8_EVENT_DISPLAY;
 }
 
-void RET_00EE(void) {
+void RET_00EE(chip8_t *c) {
 	/* get address at the top of the stack and jump to it */
-	chip8.pc = chip8.stack[--chip8.sp];
+	c->pc = c->stack[--c->sp];
 }
 
-void JP_1nnn(void) {
+void JP_1nnn(chip8_t *c) {
 	/* set program counter to nnn */
-	u16 address = chip8.opcode & 0x0FFF;
-	chip8.pc = address;
+	u16 address = c->opcode & 0x0FFF;
+	c->pc = address;
 }
 
-void CALL_2nnn(void) {
+void CALL_2nnn(chip8_t *c) {
 	/* add address to the top of the stack */
-	u16 address = chip8.opcode & 0x0FFF;
-	chip8.stack[chip8.sp++] = chip8.pc;
-	chip8.pc = address;
+	u16 address = c->opcode & 0x0FFF;
+	c->stack[c->sp++] = c->pc;
+	c->pc = address;
 }
 
-void SE_3xkk(void) {
+void SE_3xkk(chip8_t *c) {
 	/* skip to next instruction if register Vx == kk */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 kk = chip8.opcode & 0x00FF;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 kk = c->opcode & 0x00FF;
 
-	if (chip8.registers[vx] == kk)
-		chip8.pc += 2;
+	if (c->registers[vx] == kk)
+		c->pc += 2;
 }
 
-void SNE_4xkk(void) {
+void SNE_4xkk(chip8_t *c) {
 	/* skip to next instruction if register Vx != kk */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 kk = chip8.opcode & 0x00FF;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 kk = c->opcode & 0x00FF;
 
-	if (chip8.registers[vx] != kk)
-		chip8.pc += 2;
+	if (c->registers[vx] != kk)
+		c->pc += 2;
 }
 
-void SE_5xy0(void) {
+void SE_5xy0(chip8_t *c) {
 	/* skip to next instruction if register Vx == register Vy */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	if (chip8.registers[vx] == chip8.registers[vy])
-		chip8.pc += 2;
+	if (c->registers[vx] == c->registers[vy])
+		c->pc += 2;
 }
 
-void LD_6xkk(void) {
+void LD_6xkk(chip8_t *c) {
 	/* load value kk into register Vx */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 value = chip8.opcode & 0x00FF;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 value = c->opcode & 0x00FF;
 
-	chip8.registers[vx] = value;
+	c->registers[vx] = value;
 }
 
-void ADD_7xkk(void) {
+void ADD_7xkk(chip8_t *c) {
 	/* add kk to register Vx */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 value = chip8.opcode & 0x00FF;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 value = c->opcode & 0x00FF;
 
-	chip8.registers[vx] += value;
+	c->registers[vx] += value;
 }
 
-void LD_8xy0(void) {
+void LD_8xy0(chip8_t *c) {
 	/* Vx = Vy */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	chip8.registers[vx] = chip8.registers[vy];
+	c->registers[vx] = c->registers[vy];
 }
 
-void OR_8xy1(void) {
+void OR_8xy1(chip8_t *c) {
 	/* Vx |= Vy */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	chip8.registers[vx] |= chip8.registers[vy];
+	c->registers[vx] |= c->registers[vy];
 }
 
-void AND_8xy2(void) {
+void AND_8xy2(chip8_t *c) {
 	/* Vx &= Vy */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	chip8.registers[vx] &= chip8.registers[vy];
+	c->registers[vx] &= c->registers[vy];
 }
 
-void XOR_8xy3(void) {
+void XOR_8xy3(chip8_t *c) {
 	/* Vx ^= Vy */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	chip8.registers[vx] ^= chip8.registers[vy];
+	c->registers[vx] ^= c->registers[vy];
 }
 
-void ADD_8xy4(void) {
+void ADD_8xy4(chip8_t *c) {
 	/* Vx += Vy, VF = carry */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	u16 res = (u16)chip8.registers[vx] + chip8.registers[vy];
-	chip8.registers[0xF] = res > 255;
-	chip8.registers[vx] = (u8)res;
+	u16 res = (u16)c->registers[vx] + c->registers[vy];
+	c->registers[0xF] = res > 255;
+	c->registers[vx] = (u8)res;
 }
 
-void SUB_8xy5(void) {
+void SUB_8xy5(chip8_t *c) {
 	/* Vx += Vy, VF = NOT borrow */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	chip8.registers[0xF] = chip8.registers[vx] > chip8.registers[vy];
-	chip8.registers[vx] -= chip8.registers[vy];
+	c->registers[0xF] = c->registers[vx] > c->registers[vy];
+	c->registers[vx] -= c->registers[vy];
 }
 
-void SHR_8xy6(void) {
+void SHR_8xy6(chip8_t *c) {
 	/* if Vx least significant bit is 1 then VF is set to 1,
 	 * otherwise it is set to 0
 	 * Vx is then divided by 2
 	 */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
 #ifdef USE_ORIGINAL
-	chip8.registers[vx] = chip8.registers[vy];
+	c->registers[vx] = c->registers[vy];
 #endif
 
-	chip8.registers[0xF] = chip8.registers[vx] & 0x1;
-	chip8.registers[vx] >>= 1;
+	c->registers[0xF] = c->registers[vx] & 0x1;
+	c->registers[vx] >>= 1;
 }
 
-void SUBN_8xy7(void) {
+void SUBN_8xy7(chip8_t *c) {
 	/* Vx = Vy - Vx, VF = NOT borrow */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	chip8.registers[0xF] = chip8.registers[vy] > chip8.registers[vx];
-	chip8.registers[vx] = chip8.registers[vy] - chip8.registers[vx];
+	c->registers[0xF] = c->registers[vy] > c->registers[vx];
+	c->registers[vx] = c->registers[vy] - c->registers[vx];
 }
 
-void SHL_8xyE(void) {
+void SHL_8xyE(chip8_t *c) {
 	/* if Vx most significant bit is 1 then VF is set to 1,
 	 * otherwise it is set to 0
 	 * Vx is then multiplied by 2
 	 */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
 
 #ifdef USE_ORIGINAL
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
-	chip8.registers[vx] = chip8.registers[vy];
+	u8 vy = (c->opcode & 0x00F0) >> 4;
+	c->registers[vx] = c->registers[vy];
 #endif
 
 	// set VF to the MSB
-	chip8.registers[0xF] = (chip8.registers[vx] & 0x80) >> 7;
-	chip8.registers[vx] <<= 1;
+	c->registers[0xF] = (c->registers[vx] & 0x80) >> 7;
+	c->registers[vx] <<= 1;
 }
 
-void SNE_9xy0(void) {
+void SNE_9xy0(chip8_t *c) {
 	/* skip to next instruction if register Vx == register Vy */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
 
-	if (chip8.registers[vx] != chip8.registers[vy])
-		chip8.pc += 2;
+	if (c->registers[vx] != c->registers[vy])
+		c->pc += 2;
 }
 
-void LD_Annn(void) {
+void LD_Annn(chip8_t *c) {
 	/* load value nnn into register I */
-	u16 value = chip8.opcode & 0x0FFF;
+	u16 value = c->opcode & 0x0FFF;
 
-	chip8.index = value;
+	c->index = value;
 }
 
-void JP_Bnnn(void) {
+void JP_Bnnn(chip8_t *c) {
 	/* Set program counter to nnn + V0 */
-	u16 address = chip8.opcode & 0x0FFF;
+	u16 address = c->opcode & 0x0FFF;
 
 #ifdef USE_ORIGINAL
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	address += chip8.registers[vx];
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	address += c->registers[vx];
 #else
-	address += chip8.registers[0x0];
+	address += c->registers[0x0];
 #endif
 
-	chip8.pc = address;
+	c->pc = address;
 }
 
-void RND_Cxkk(void) {
+void RND_Cxkk(chip8_t *c) {
 	/* set Vx to a random byte & kk */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 kk = chip8.opcode & 0x00FF;
-	u8 rnd = (u8)(rand() % 256);
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 kk = c->opcode & 0x00FF;
+	u8 rnd = random_byte(c);
 	
-	chip8.registers[vx] = rnd & kk;
+	c->registers[vx] = rnd & kk;
 }
 
-void DRW_Dxyn(void) {
+void DRW_Dxyn(chip8_t *c) {
 	/* Read n bytes from memory starting at addres stored in I
 	 * these bytes are then displayed as sprites on screen at coordinates
 	 * stored in registers vx and vy, the coordinates wrap
@@ -545,103 +775,106 @@ void DRW_Dxyn(void) {
 	 * the sprite is guaranteed to be 8 pixels wide
 	 */
 
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 vy = (chip8.opcode & 0x00F0) >> 4;
-	u8 height  =  chip8.opcode & 0x000F;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 vy = (c->opcode & 0x00F0) >> 4;
+	u8 height  =  c->opcode & 0x000F;
 
-	u8 x = chip8.registers[vx];
-	u8 y = chip8.registers[vy];
+	u8 x = c->registers[vx] % CHIP8_DISPLAY_WIDTH;
+	u8 y = c->registers[vy];
 
-	chip8.registers[0xF] = 0;
+	c->registers[0xF] = 0;
 
 	for (u8 row = 0; row < height; ++row) {
-		u8 sprite_byte = chip8.memory[chip8.index + row];
-		for (u8 column = 0; column < 8; ++column) {
-			u8 sprite_px = sprite_byte & (0x80 >> column);
-			u8 xpos = (x + column) % DISPLAY_WIDTH;
-			u8 ypos = (y + row) % DISPLAY_HEIGHT;
-			u32 *screen_px = &chip8.display[ypos][xpos];
-			
-			// if this is a sprite pixel
-			if (sprite_px) {
-				// if the same pixel is already on, set the 
-				// VF register to 1
-				if (*screen_px)
-					chip8.registers[0xF] = 1;
-				
-				// XOR pixel
-				*screen_px ^= 0xFFFFFFFF;
-			}
-		}
+		WATCH_READ(c, c->index + row);
+		u8 sprite_byte = mem_read(c, c->index + row);
+		u8 ypos = (y + row) % CHIP8_DISPLAY_HEIGHT;
+
+		// move the sprite byte to column x, wrapping around the right edge
+		u64 sprite_row = (u64)sprite_byte << (CHIP8_DISPLAY_WIDTH - 8);
+		if (x)
+			sprite_row = (sprite_row >> x) | (sprite_row << (CHIP8_DISPLAY_WIDTH - x));
+
+		// if any of the pixels is already on, set the
+		// VF register to 1
+		if (c->display[ypos] & sprite_row)
+			c->registers[0xF] = 1;
+
+		// XOR pixels
+		if (c->hash_armed)
+			c->state_hash ^= hash_row(ypos, c->display[ypos]) ^ hash_row(ypos, c->display[ypos] ^ sprite_row);
+		c->display[ypos] ^= sprite_row;
 	}
+
+	c->events |= CHIP8_EVENT_DISPLAY;
 }
 
-void SKP_Ex9E(void) {
+void SKP_Ex9E(chip8_t *c) {
 	/* pc += 2 if key Vx is pressed */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
 
-	if (chip8.keypad[chip8.registers[vx]])
-		chip8.pc += 2;
+	if (c->keypad & (1 << (c->registers[vx] & 0xF)))
+		c->pc += 2;
 }
 
 
-void SKNP_ExA1(void) {
+void SKNP_ExA1(chip8_t *c) {
 	/* pc += 2 if key Vx is NOT pressed */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
 
-	if (!chip8.keypad[chip8.registers[vx]])
-		chip8.pc += 2;
+	if (!(c->keypad & (1 << (c->registers[vx] & 0xF))))
+		c->pc += 2;
 }
 
-void LD_Fx07(void) {
+void LD_Fx07(chip8_t *c) {
 	/* Vx = delay timer */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	chip8.registers[vx] = chip8.delay_timer;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	c->registers[vx] = c->delay_timer;
 }
 
-void LD_Fx0a(void) {
+void LD_Fx0a(chip8_t *c) {
 	/* wait for a key to be pressed (by decreasing pc)
 	 * the value of the key is stored in Vx
 	 */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
 	
 	for (u8 i = 0; i < 16; ++i) {
-		if (chip8.keypad[i]) {
-			chip8.registers[vx] = i;
+		if (c->keypad & (1 << i)) {
+			c->registers[vx] = i;
 			return;
 		}
 	}
 	
-	chip8.pc -= 2;
+	c->pc -= 2;
+	c->events |= CHIP8_EVENT_WAIT_KEY;
 }
 
-void LD_Fx15(void) {
+void LD_Fx15(chip8_t *c) {
 	/* delay timer = Vx */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	chip8.delay_timer = vx;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	c->delay_timer = vx;
 }
 
-void LD_Fx18(void) {
+void LD_Fx18(chip8_t *c) {
 	/* sound timer = Vx */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	chip8.sound_timer = chip8.registers[vx];
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	c->sound_timer = c->registers[vx];
 }
 
-void ADD_Fx1E(void) {
+void ADD_Fx1E(chip8_t *c) {
 	/* register I += Vx */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	chip8.index += vx;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	c->index += vx;
 }
 
-void LD_Fx29(void) {
+void LD_Fx29(chip8_t *c) {
 	/* returns position in memory of digit Vx from font */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 digit = chip8.registers[vx];
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 digit = c->registers[vx];
 
-	chip8.index = FONTSET_START_ADDRESS + (5 * digit);
+	c->index = FONTSET_START_ADDRESS + (5 * digit);
 }
 
-void LD_Fx33(void) {
+void LD_Fx33(chip8_t *c) {
 	/* store in BCD representation value of Vx in
 	 * memory in I, I+1 and I+2.
 	 * BCD means:
@@ -651,40 +884,48 @@ void LD_Fx33(void) {
 	 * mem[i+2] = 4 -> 15[4]
 	 */
 	
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
-	u8 value = chip8.registers[vx];
+	u8 vx = (c->opcode & 0x0F00) >> 8;
+	u8 value = c->registers[vx];
+
+	WATCH_WRITE(c, c->index);
+	WATCH_WRITE(c, c->index + 1);
+	WATCH_WRITE(c, c->index + 2);
 
-	chip8.memory[chip8.index + 2] = value % 10;
+	mem_write(c, c->index + 2, value % 10);
 	value /= 10;
 
-	chip8.memory[chip8.index + 1] = value % 10;
+	mem_write(c, c->index + 1, value % 10);
 	value /= 10;
 
-	chip8.memory[chip8.index] = value % 10;
+	mem_write(c, c->index, value % 10);
 }
 
-void LD_Fx55(void) {
+void LD_Fx55(chip8_t *c) {
 	/* store register from V0 to Vx in memory from I */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
 
 	for (u8 i = 0; i < vx; ++i) {
 #ifdef USE_ORIGINAL
-		chip8.memory[chip8.index++] = chip8.registers[i];
+		WATCH_WRITE(c, c->index);
+		mem_write(c, c->index++, c->registers[i]);
 #else
-		chip8.memory[chip8.index + i] = chip8.registers[i];
+		WATCH_WRITE(c, c->index + i);
+		mem_write(c, c->index + i, c->registers[i]);
 #endif
 	}
 }
 
-void LD_Fx65(void) {
+void LD_Fx65(chip8_t *c) {
 	/* read memory from i in registers V0 to Vx */
-	u8 vx = (chip8.opcode & 0x0F00) >> 8;
+	u8 vx = (c->opcode & 0x0F00) >> 8;
 
 	for (u8 i = 0; i < vx; ++i) {
 #ifdef USE_ORIGINAL
-		chip8.registers[i] = chip8.memory[chip8.index++];
+		WATCH_READ(c, c->index);
+		c->registers[i] = mem_read(c, c->index++);
 #else
-		chip8.registers[i] = chip8.memory[chip8.index + i];
+		WATCH_READ(c, c->index + i);
+		c->registers[i] = mem_read(c, c->index + i);
 #endif
 	}
 }
\ No newline at end of file
@@ -2,14 +2,113 @@
 #define CHIP8_H
 
 #include "types.h"
-typedef struct sapp_event sapp_event;
 
-void chip8_init();
-int  chip8_load_data(void *data, u32 size);
-int  chip8_load_file(const char *fname);
-void chip8_update();
-void chip8_input(const sapp_event *e);
-void chip8_render();
-void chip8_cleanup();
+enum {
+	CHIP8_MEMORY_SIZE = 4096,
+	CHIP8_PAGE_SIZE = 256,
+	CHIP8_PAGE_COUNT = CHIP8_MEMORY_SIZE / CHIP8_PAGE_SIZE,
+	CHIP8_DISPLAY_WIDTH = 64,
+	CHIP8_DISPLAY_HEIGHT = 32,
+};
 
-#endif
\ No newline at end of file
+// reasons for chip8_run to return early, several can be set at once
+enum {
+	CHIP8_EVENT_DISPLAY  = 1 << 0, // CLS or DRW touched the display
+	CHIP8_EVENT_WAIT_KEY = 1 << 1, // Fx0A is blocked waiting for a key
+	CHIP8_EVENT_SOUND    = 1 << 2, // the sound timer started or stopped
+	CHIP8_EVENT_FAULT    = 1 << 3, // undefined opcode or out of memory, execution is halted
+	CHIP8_EVENT_BREAK    = 1 << 4, // the debugger stopped execution
+};
+
+typedef struct chip8_trace_t chip8_trace_t;
+typedef struct chip8_debug_t chip8_debug_t;
+
+/* Memory image of a ROM (font + program), shared read-only by every
+ * instance running it. Pages are only copied into an instance the first
+ * time it writes to them. Reference counting is not thread safe.
+ */
+typedef struct chip8_rom_t chip8_rom_t;
+
+typedef struct chip8_t {
+	u8 registers[16];
+	u16 index;
+	u16 pc;
+	u16 stack[16];
+	u8 sp;
+	u8 delay_timer;
+	u8 sound_timer;
+	u8 debug_armed;     // set by the debugger while it needs the hooks
+	u8 faulted;         // undefined opcode or out of memory, execution is halted
+	u8 events;          // CHIP8_EVENT_* raised since the last update / run
+	u8 hash_armed;      // set by chip8_hash_enable
+	u16 keypad;         // one bit per key
+	u16 opcode;
+	u16 private_pages;  // pages owned by this instance
+	u32 rng;
+	u64 instructions;   // executed since chip8_init
+	u64 state_hash;     // memory and display part of the state hash
+
+	const u8 *pages[CHIP8_PAGE_COUNT];
+	chip8_rom_t *rom;
+	chip8_trace_t *trace; // optional
+	chip8_debug_t *debug; // allocated by the debugger
+
+	// one bit per pixel, the MSB of each row is the leftmost pixel
+	u64 display[CHIP8_DISPLAY_HEIGHT];
+} chip8_t;
+
+// read-only copy of the cpu state, used by the debugger and tools
+typedef struct {
+	u8 registers[16];
+	u16 index;
+	u16 pc;
+	u16 stack[16];
+	u8 sp;
+	u8 delay_timer;
+	u8 sound_timer;
+	u16 opcode;
+} chip8_cpu_state_t;
+
+chip8_rom_t *chip8_rom_create(const void *data, u32 size);
+chip8_rom_t *chip8_rom_load(const char *fname);
+void chip8_rom_acquire(chip8_rom_t *rom);
+void chip8_rom_release(chip8_rom_t *rom);
+
+// c must not hold an instance: call chip8_cleanup first to reuse one
+void chip8_init(chip8_t *c);
+int  chip8_load_rom(chip8_t *c, chip8_rom_t *rom);
+int  chip8_load_data(chip8_t *c, const void *data, u32 size);
+int  chip8_load_file(chip8_t *c, const char *fname);
+// executes a single instruction
+void chip8_update(chip8_t *c);
+/* executes up to max_cycles instructions, stopping early after the first
+ * one that raises an event. returns the number of instructions executed,
+ * exit_reason (optional) gets the events, 0 if the budget ran out.
+ */
+u32  chip8_run(chip8_t *c, u32 max_cycles, u32 *exit_reason);
+void chip8_input(chip8_t *c, u8 key, u8 is_down);
+void chip8_cleanup(chip8_t *c);
+
+void chip8_seed(chip8_t *c, u32 seed);
+void chip8_get_cpu_state(const chip8_t *c, chip8_cpu_state_t *state);
+u8   chip8_peek(const chip8_t *c, u16 address);
+/* copies src into dst (which must not hold an instance), dst gets its own
+ * copy of the private pages. trace and debugger aren't copied.
+ */
+int  chip8_clone(chip8_t *dst, const chip8_t *src);
+// bytes of memory private to this instance
+u32  chip8_footprint(const chip8_t *c);
+
+
+/* State hashing, used to compare cores running in lockstep.
+ * Once enabled every memory and display write updates a running XOR hash
+ * of the changed byte / row, so the 4 KB of memory and the display are
+ * never rehashed. The cpu registers are small and are folded in by
+ * chip8_state_hash when it is called.
+ */
+void chip8_hash_enable(chip8_t *c);
+u64  chip8_state_hash(const chip8_t *c);
+// same value computed from scratch, to check the running hash
+u64  chip8_state_hash_full(const chip8_t *c);
+
+#endif
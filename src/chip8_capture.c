@@ -0,0 +1,298 @@
+#include "chip8_capture.h"
+#include "chip8_delta.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+#define CAPTURE_NO_THREADS
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+typedef HANDLE thread_t;
+typedef CRITICAL_SECTION mutex_t;
+typedef CONDITION_VARIABLE cond_t;
+#define mutex_init(m)    InitializeCriticalSection(m)
+#define mutex_destroy(m) DeleteCriticalSection(m)
+#define mutex_lock(m)    EnterCriticalSection(m)
+#define mutex_unlock(m)  LeaveCriticalSection(m)
+#define cond_init(c)     InitializeConditionVariable(c)
+#define cond_destroy(c)
+#define cond_wait(c, m)  SleepConditionVariableCS(c, m, INFINITE)
+#define cond_signal(c)   WakeConditionVariable(c)
+#else
+#include <pthread.h>
+typedef pthread_t thread_t;
+typedef pthread_mutex_t mutex_t;
+typedef pthread_cond_t cond_t;
+#define mutex_init(m)    pthread_mutex_init(m, NULL)
+#define mutex_destroy(m) pthread_mutex_destroy(m)
+#define mutex_lock(m)    pthread_mutex_lock(m)
+#define mutex_unlock(m)  pthread_mutex_unlock(m)
+#define cond_init(c)     pthread_cond_init(c, NULL)
+#define cond_destroy(c)  pthread_cond_destroy(c)
+#define cond_wait(c, m)  pthread_cond_wait(c, m)
+#define cond_signal(c)   pthread_cond_signal(c)
+#endif
+
+typedef struct {
+	chip8_capture_t *cap;
+	u64 rows[CHIP8_DELTA_ROWS];
+	u32 skipped; // frames of cap dropped right before this one
+} frame_t;
+
+struct chip8_capture_t {
+	FILE *file;
+	u32 dropped;
+	u32 skipped; // producer side, dropped since the last queued frame
+
+	// writer side
+	u64 last[CHIP8_DELTA_ROWS];
+	u32 repeats;
+
+	chip8_capture_t *next_closed;
+};
+
+static void write_repeats(chip8_capture_t *cap) {
+	u8 buf[6] = { CHIP8_CAPTURE_REPEAT };
+	if (cap->repeats) {
+		u32 len = 1 + chip8_delta_put_varint(buf + 1, cap->repeats);
+		fwrite(buf, len, 1, cap->file);
+		cap->repeats = 0;
+	}
+}
+
+static void write_frame(chip8_capture_t *cap, const u64 *rows, u32 skipped) {
+	cap->repeats += skipped;
+
+	if (!memcmp(rows, cap->last, sizeof(cap->last))) {
+		cap->repeats++;
+		return;
+	}
+
+	write_repeats(cap);
+
+	u8 buf[1 + 5 + CHIP8_DELTA_MAX_SIZE];
+	u8 delta[CHIP8_DELTA_MAX_SIZE];
+	u32 size = chip8_delta_encode(cap->last, rows, delta);
+	u32 len = 0;
+
+	buf[len++] = CHIP8_CAPTURE_DELTA;
+	len += chip8_delta_put_varint(buf + len, size);
+	memcpy(buf + len, delta, size);
+	fwrite(buf, len + size, 1, cap->file);
+
+	memcpy(cap->last, rows, sizeof(cap->last));
+}
+
+static void finish(chip8_capture_t *cap) {
+	// frames dropped at the very end are kept as repeats
+	cap->repeats += cap->skipped;
+	write_repeats(cap);
+	fclose(cap->file);
+	free(cap);
+}
+
+// == writer thread ===========================================
+
+#ifndef CAPTURE_NO_THREADS
+
+/* one writer serves every open capture. Producers only fill slots between
+ * head and tail + CHIP8_CAPTURE_QUEUE_SIZE, so the thread can write the
+ * frames it has seen without holding the lock and free their slots after.
+ */
+static struct {
+	u8 started;
+	thread_t thread;
+	mutex_t mutex;
+	cond_t cond;
+	frame_t *queue;
+	u32 head;
+	u32 tail;
+	u8 stop;
+	chip8_capture_t *closed; // handed over by chip8_capture_close
+} writer;
+
+#ifdef _WIN32
+static DWORD WINAPI writer_thread(LPVOID arg) {
+#else
+static void *writer_thread(void *arg) {
+#endif
+	(void)arg;
+
+	mutex_lock(&writer.mutex);
+	for (;;) {
+		while (writer.head == writer.tail && !writer.closed && !writer.stop)
+			cond_wait(&writer.cond, &writer.mutex);
+		if (writer.head == writer.tail && !writer.closed)
+			break;
+
+		// frames are queued before their capture is closed, so write
+		// them before finishing the closed captures
+		u32 head = writer.head;
+		u32 tail = writer.tail;
+		chip8_capture_t *closed = writer.closed;
+		writer.closed = NULL;
+		mutex_unlock(&writer.mutex);
+
+		for (; tail != head; ++tail) {
+			frame_t *frame = &writer.queue[tail % CHIP8_CAPTURE_QUEUE_SIZE];
+			write_frame(frame->cap, frame->rows, frame->skipped);
+		}
+		while (closed) {
+			chip8_capture_t *next = closed->next_closed;
+			finish(closed);
+			closed = next;
+		}
+
+		mutex_lock(&writer.mutex);
+		writer.tail = tail;
+	}
+	mutex_unlock(&writer.mutex);
+
+	return 0;
+}
+
+// started by the first chip8_capture_open
+static int start_writer(void) {
+	writer.queue = (frame_t *)malloc(CHIP8_CAPTURE_QUEUE_SIZE * sizeof(frame_t));
+	if (!writer.queue)
+		PANIC("couldn't allocate capture queue", failed_alloc);
+
+	mutex_init(&writer.mutex);
+	cond_init(&writer.cond);
+	writer.head = writer.tail = 0;
+	writer.stop = 0;
+
+#ifdef _WIN32
+	writer.thread = CreateThread(NULL, 0, writer_thread, NULL, 0, NULL);
+	if (!writer.thread)
+#else
+	if (pthread_create(&writer.thread, NULL, writer_thread, NULL))
+#endif
+		PANIC("couldn't start capture thread", failed_thread);
+
+	writer.started = 1;
+	return 0;
+
+failed_thread:
+	cond_destroy(&writer.cond);
+	mutex_destroy(&writer.mutex);
+	free(writer.queue);
+	writer.queue = NULL;
+failed_alloc:
+	return -1;
+}
+
+static void queue_frame(chip8_capture_t *cap, const u64 *rows) {
+	mutex_lock(&writer.mutex);
+	if (writer.head - writer.tail < CHIP8_CAPTURE_QUEUE_SIZE) {
+		frame_t *frame = &writer.queue[writer.head++ % CHIP8_CAPTURE_QUEUE_SIZE];
+		frame->cap = cap;
+		memcpy(frame->rows, rows, sizeof(frame->rows));
+		frame->skipped = cap->skipped;
+		cap->skipped = 0;
+		cond_signal(&writer.cond);
+	}
+	else {
+		cap->skipped++;
+		cap->dropped++;
+	}
+	mutex_unlock(&writer.mutex);
+}
+
+static void queue_close(chip8_capture_t *cap) {
+	mutex_lock(&writer.mutex);
+	cap->next_closed = writer.closed;
+	writer.closed = cap;
+	cond_signal(&writer.cond);
+	mutex_unlock(&writer.mutex);
+}
+
+#endif
+
+// == API =====================================================
+
+chip8_capture_t *chip8_capture_open(const char *fname, u8 fps) {
+#ifndef CAPTURE_NO_THREADS
+	if (!writer.started && start_writer())
+		goto failed_alloc;
+#endif
+
+	chip8_capture_t *cap = (chip8_capture_t *)calloc(1, sizeof(chip8_capture_t));
+	if (!cap)
+		PANIC("couldn't allocate capture", failed_alloc);
+
+	cap->file = fopen(fname, "wb");
+	if (!cap->file)
+		PANIC("couldn't open capture file", failed_open);
+
+	u8 header[CHIP8_CAPTURE_HEADER_SIZE] = { 'C', '8', 'C', 'P', CHIP8_CAPTURE_VERSION, 64, 32, fps };
+	if (fwrite(header, sizeof(header), 1, cap->file) != 1)
+		PANIC("couldn't write capture header", failed_write);
+
+	return cap;
+
+failed_write:
+	fclose(cap->file);
+failed_open:
+	free(cap);
+failed_alloc:
+	return NULL;
+}
+
+void chip8_capture_frame(chip8_capture_t *cap, const u64 *rows) {
+	if (!cap)
+		return;
+
+#ifndef CAPTURE_NO_THREADS
+	queue_frame(cap, rows);
+#else
+	write_frame(cap, rows, 0);
+#endif
+}
+
+void chip8_capture_close(chip8_capture_t *cap) {
+	if (!cap)
+		return;
+
+	if (cap->dropped)
+		printf("capture: %u frames dropped\n", cap->dropped);
+
+#ifndef CAPTURE_NO_THREADS
+	queue_close(cap);
+#else
+	finish(cap);
+#endif
+}
+
+u32 chip8_capture_dropped(const chip8_capture_t *cap) {
+	return cap ? cap->dropped : 0;
+}
+
+void chip8_capture_shutdown(void) {
+#ifndef CAPTURE_NO_THREADS
+	if (!writer.started)
+		return;
+
+	mutex_lock(&writer.mutex);
+	writer.stop = 1;
+	cond_signal(&writer.cond);
+	mutex_unlock(&writer.mutex);
+
+#ifdef _WIN32
+	WaitForSingleObject(writer.thread, INFINITE);
+	CloseHandle(writer.thread);
+#else
+	pthread_join(writer.thread, NULL);
+#endif
+
+	cond_destroy(&writer.cond);
+	mutex_destroy(&writer.mutex);
+	free(writer.queue);
+	writer.queue = NULL;
+	writer.started = 0;
+#endif
+}
@@ -0,0 +1,46 @@
+#ifndef CHIP8_CAPTURE_H
+#define CHIP8_CAPTURE_H
+
+#include "types.h"
+
+/* Headless recording of frames, one handle per recorded instance.
+ * chip8_capture_frame only copies the frame into a bounded queue shared
+ * by every open capture; a single background thread delta-encodes the
+ * frames (see chip8_delta.h) and writes them to disk. When the queue is
+ * full the frame is dropped and recorded as a repeat of the previous one,
+ * so the emulation never waits on disk. chip8_capture_close hands the
+ * handle to the writer, which finishes and closes the file; call
+ * chip8_capture_shutdown before exiting to wait for that. Captures are
+ * opened and closed from one thread, frames may come from any.
+ * On platforms without threads frames are written by the caller.
+ * Frames are expected at the rate written in the header.
+ *
+ * file layout:
+ *   "C8CP", u8 version, u8 width, u8 height, u8 frames per second
+ *   records: u8 type followed by
+ *     CHIP8_CAPTURE_REPEAT: varint n, the previous frame is shown n more times
+ *     CHIP8_CAPTURE_DELTA:  varint size, delta against the previous frame
+ */
+
+enum {
+	CHIP8_CAPTURE_VERSION = 1,
+	CHIP8_CAPTURE_HEADER_SIZE = 8,
+	CHIP8_CAPTURE_QUEUE_SIZE = 4096, // frames, of all captures
+
+	CHIP8_CAPTURE_REPEAT = 0,
+	CHIP8_CAPTURE_DELTA = 1,
+};
+
+typedef struct chip8_capture_t chip8_capture_t;
+
+chip8_capture_t *chip8_capture_open(const char *fname, u8 fps);
+void chip8_capture_frame(chip8_capture_t *cap, const u64 *rows);
+void chip8_capture_close(chip8_capture_t *cap);
+
+// number of frames dropped because the writer fell behind
+u32  chip8_capture_dropped(const chip8_capture_t *cap);
+
+// waits until every closed capture is written, stops the writer
+void chip8_capture_shutdown(void);
+
+#endif
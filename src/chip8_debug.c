@@ -0,0 +1,512 @@
+#include "chip8_debug.h"
+#include "chip8.h"
+#include "chip8_disasm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+
+enum {
+	MEMORY_SIZE = 4096,
+	BITMAP_SIZE = MEMORY_SIZE / 8,
+	MAX_CONDITIONS = 16,
+};
+
+typedef struct {
+	u16 address;
+	u8 reg;
+	u8 cmp;
+	u8 value;
+} condition_t;
+
+struct chip8_debug_t {
+	u8 breakpoints[BITMAP_SIZE];   // any breakpoint, conditional or not
+	u8 unconditional[BITMAP_SIZE]; // plain breakpoints, ignore the conditions
+	u8 watch_read[BITMAP_SIZE];
+	u8 watch_write[BITMAP_SIZE];
+	u32 reg_watch_read;  // register masks, see CHIP8_WATCH_REG_I
+	u32 reg_watch_write;
+	condition_t conditions[MAX_CONDITIONS];
+	u8 condition_count;
+	u16 breakpoint_count;
+	u16 watch_count;
+
+	chip8_debug_state_t state;
+	u16 stop_address;
+
+	u8 resume;       // don't stop on the breakpoint we are resuming from
+	u8 step;         // stop after the next instruction
+	u8 step_over;    // stop when step_over_pc is reached at step_over_sp
+	u16 step_over_pc;
+	u8 step_over_sp;
+	u8 watch_hit;
+	u16 watch_address;
+};
+
+// allocates the debugger state on first use
+static chip8_debug_t *get_debug(chip8_t *c) {
+	if (!c->debug) {
+		c->debug = (chip8_debug_t *)calloc(1, sizeof(chip8_debug_t));
+		if (!c->debug)
+			puts("ERROR: couldn't allocate debugger\n");
+	}
+	return c->debug;
+}
+
+static inline u8 test_bit(const u8 *bitmap, u16 address) {
+	address &= MEMORY_SIZE - 1;
+	return bitmap[address >> 3] & (1 << (address & 7));
+}
+
+// sets or clears a bit, returns 1 if the bit changed
+static inline int set_bit(u8 *bitmap, u16 address, u8 enabled) {
+	u8 was_set = test_bit(bitmap, address) != 0;
+	address &= MEMORY_SIZE - 1;
+	if (enabled)
+		bitmap[address >> 3] |= 1 << (address & 7);
+	else
+		bitmap[address >> 3] &= ~(1 << (address & 7));
+	return was_set != (enabled != 0);
+}
+
+static void update_armed(chip8_t *c) {
+	chip8_debug_t *d = c->debug;
+	c->debug_armed =
+		d->breakpoint_count || d->watch_count || d->reg_watch_read || d->reg_watch_write ||
+		d->step || d->step_over || d->state != CHIP8_DEBUG_RUNNING;
+
+	// the hooks won't see the instruction being resumed from, a breakpoint
+	// armed there later must trigger
+	if (!c->debug_armed)
+		d->resume = 0;
+}
+
+static void stop(chip8_debug_t *d, chip8_debug_state_t state, u16 address) {
+	d->state = state;
+	d->stop_address = address;
+	d->step = 0;
+	d->step_over = 0;
+}
+
+// == control =================================================
+
+void chip8_debug_detach(chip8_t *c) {
+	free(c->debug);
+	c->debug = NULL;
+	c->debug_armed = 0;
+}
+
+static void mark_breakpoint(chip8_debug_t *d, u16 address, u8 enabled) {
+	if (set_bit(d->breakpoints, address, enabled))
+		d->breakpoint_count += enabled ? 1 : -1;
+}
+
+void chip8_debug_set_breakpoint(chip8_t *c, u16 address, u8 enabled) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d)
+		return;
+
+	mark_breakpoint(d, address, enabled);
+	set_bit(d->unconditional, address, enabled);
+
+	// deleting a breakpoint also deletes its conditions
+	if (!enabled) {
+		u8 kept = 0;
+		for (u8 i = 0; i < d->condition_count; ++i) {
+			if (d->conditions[i].address != address)
+				d->conditions[kept++] = d->conditions[i];
+		}
+		d->condition_count = kept;
+	}
+
+	update_armed(c);
+}
+
+int chip8_debug_add_condition(chip8_t *c, u16 address, u8 reg, chip8_cmp_t cmp, u8 value) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d || d->condition_count >= MAX_CONDITIONS || reg > 0xF)
+		return -1;
+
+	d->conditions[d->condition_count++] = (condition_t){
+		.address = address,
+		.reg = reg,
+		.cmp = (u8)cmp,
+		.value = value,
+	};
+	// a plain breakpoint already at address stays unconditional
+	mark_breakpoint(d, address, 1);
+	update_armed(c);
+	return 0;
+}
+
+void chip8_debug_set_watchpoint(chip8_t *c, u16 address, u16 length, u8 flags) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d)
+		return;
+
+	for (u16 i = 0; i < length; ++i) {
+		u16 a = address + i;
+		if (set_bit(d->watch_read, a, flags & CHIP8_WATCH_READ))
+			d->watch_count += (flags & CHIP8_WATCH_READ) ? 1 : -1;
+		if (set_bit(d->watch_write, a, flags & CHIP8_WATCH_WRITE))
+			d->watch_count += (flags & CHIP8_WATCH_WRITE) ? 1 : -1;
+	}
+
+	update_armed(c);
+}
+
+void chip8_debug_set_reg_watch(chip8_t *c, u32 mask, u8 flags) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d)
+		return;
+
+	d->reg_watch_read = flags & CHIP8_WATCH_READ ? mask : 0;
+	d->reg_watch_write = flags & CHIP8_WATCH_WRITE ? mask : 0;
+	update_armed(c);
+}
+
+void chip8_debug_clear_all(chip8_t *c) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d)
+		return;
+
+	chip8_debug_state_t state = d->state;
+	u16 stop_address = d->stop_address;
+
+	memset(d, 0, sizeof(*d));
+	d->state = state;
+	d->stop_address = stop_address;
+
+	update_armed(c);
+}
+
+void chip8_debug_pause(chip8_t *c) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d)
+		return;
+
+	if (d->state == CHIP8_DEBUG_RUNNING)
+		stop(d, CHIP8_DEBUG_PAUSED, c->pc);
+	update_armed(c);
+}
+
+void chip8_debug_continue(chip8_t *c) {
+	chip8_debug_t *d = get_debug(c);
+	if (!d)
+		return;
+
+	if (d->state != CHIP8_DEBUG_RUNNING) {
+		d->state = CHIP8_DEBUG_RUNNING;
+		d->resume = 1;
+	}
+	update_armed(c);
+}
+
+void chip8_debug_step(chip8_t *c) {
+	chip8_debug_continue(c);
+	if (!c->debug)
+		return;
+
+	c->debug->step = 1;
+	update_armed(c);
+}
+
+void chip8_debug_step_over(chip8_t *c) {
+	// only calls are stepped over, anything else is a single step
+	if ((chip8_peek(c, c->pc) >> 4) != 0x2) {
+		chip8_debug_step(c);
+		return;
+	}
+
+	chip8_debug_continue(c);
+	if (!c->debug)
+		return;
+
+	c->debug->step_over = 1;
+	c->debug->step_over_pc = c->pc + 2;
+	c->debug->step_over_sp = c->sp;
+	update_armed(c);
+}
+
+chip8_debug_state_t chip8_debug_state(const chip8_t *c) {
+	return c->debug ? c->debug->state : CHIP8_DEBUG_RUNNING;
+}
+
+u16 chip8_debug_stop_address(const chip8_t *c) {
+	return c->debug ? c->debug->stop_address : 0;
+}
+
+u16 chip8_debug_watch_address(const chip8_t *c) {
+	return c->debug ? c->debug->watch_address : 0;
+}
+
+// == hooks ===================================================
+
+static int check_conditions(const chip8_debug_t *d, u16 pc, const u8 *registers) {
+	if (test_bit(d->unconditional, pc))
+		return 1;
+
+	for (u8 i = 0; i < d->condition_count; ++i) {
+		const condition_t *cond = &d->conditions[i];
+		if (cond->address != pc)
+			continue;
+
+		u8 reg = registers[cond->reg];
+		switch (cond->cmp) {
+		case CHIP8_CMP_EQ: if (reg == cond->value) return 1; break;
+		case CHIP8_CMP_NE: if (reg != cond->value) return 1; break;
+		case CHIP8_CMP_LT: if (reg <  cond->value) return 1; break;
+		case CHIP8_CMP_GT: if (reg >  cond->value) return 1; break;
+		}
+	}
+
+	return 0;
+}
+
+int chip8_debug_before_step(chip8_t *c) {
+	chip8_debug_t *d = c->debug;
+	u16 pc = c->pc;
+
+	if (d->state != CHIP8_DEBUG_RUNNING)
+		return 1;
+
+	u8 resume = d->resume;
+	d->resume = 0;
+
+	if (d->step_over && pc == d->step_over_pc && c->sp == d->step_over_sp) {
+		stop(d, CHIP8_DEBUG_STEPPED, pc);
+		update_armed(c);
+		return 1;
+	}
+
+	if (!resume && test_bit(d->breakpoints, pc) && check_conditions(d, pc, c->registers)) {
+		stop(d, CHIP8_DEBUG_BREAKPOINT, pc);
+		update_armed(c);
+		return 1;
+	}
+
+	return 0;
+}
+
+void chip8_debug_after_step(chip8_t *c, u16 pc) {
+	chip8_debug_t *d = c->debug;
+
+	// register accesses are decoded from the opcode, so writing the value
+	// a register already holds also triggers
+	if (d->reg_watch_read || d->reg_watch_write) {
+		u32 read, written;
+		chip8_disasm_reg_access(c->opcode, &read, &written);
+		if (c->pc == pc)
+			written = 0; // Fx0A is still waiting for a key
+
+		if ((read & d->reg_watch_read) || (written & d->reg_watch_write)) {
+			d->watch_hit = 1;
+			d->watch_address = pc;
+		}
+	}
+
+	if (d->watch_hit) {
+		d->watch_hit = 0;
+		stop(d, CHIP8_DEBUG_WATCHPOINT, pc);
+	}
+	else if (d->step) {
+		stop(d, CHIP8_DEBUG_STEPPED, pc);
+	}
+
+	update_armed(c);
+}
+
+void chip8_debug_on_read(chip8_t *c, u16 address) {
+	chip8_debug_t *d = c->debug;
+	if (test_bit(d->watch_read, address)) {
+		d->watch_hit = 1;
+		d->watch_address = address;
+	}
+}
+
+void chip8_debug_on_write(chip8_t *c, u16 address) {
+	chip8_debug_t *d = c->debug;
+	if (test_bit(d->watch_write, address)) {
+		d->watch_hit = 1;
+		d->watch_address = address;
+	}
+}
+
+// == commands ================================================
+
+/* b <addr> [Vx <==|!=|<|>> <value>]  set a (conditional) breakpoint
+ * bd <addr>                         delete a breakpoint
+ * w <r|w|rw> <addr> [len]           watch memory reads and/or writes
+ * wd <addr> [len]                   delete a memory watch
+ * wr <r|w|rw> <V0..VF|I>...         watch register reads and/or writes
+ * wr                                delete the register watch
+ * clear                             delete all breakpoints and watches
+ * c / p / s / n                     continue / pause / step / step over
+ * r                                 print registers
+ * x <addr> [len]                    dump memory
+ * d [addr] [count]                  disassemble, defaults to pc
+ */
+
+static void append(char *out, u32 size, u32 *len, const char *fmt, ...) {
+	if (*len >= size)
+		return;
+
+	va_list args;
+	va_start(args, fmt);
+	int written = vsnprintf(out + *len, size - *len, fmt, args);
+	va_end(args);
+
+	if (written > 0)
+		*len = *len + (u32)written < size ? *len + (u32)written : size;
+}
+
+static int parse_reg(const char *token) {
+	if (toupper((unsigned char)token[0]) == 'I' && token[1] == '\0')
+		return CHIP8_WATCH_REG_I;
+	if (toupper((unsigned char)token[0]) == 'V' && isxdigit((unsigned char)token[1]) && token[2] == '\0')
+		return (int)strtol(token + 1, NULL, 16);
+	return -1;
+}
+
+static int parse_cmp(const char *token) {
+	if (!strcmp(token, "==")) return CHIP8_CMP_EQ;
+	if (!strcmp(token, "!=")) return CHIP8_CMP_NE;
+	if (!strcmp(token, "<"))  return CHIP8_CMP_LT;
+	if (!strcmp(token, ">"))  return CHIP8_CMP_GT;
+	return -1;
+}
+
+static const char *state_name(chip8_debug_state_t state) {
+	switch (state) {
+	case CHIP8_DEBUG_RUNNING:    return "running";
+	case CHIP8_DEBUG_PAUSED:     return "paused";
+	case CHIP8_DEBUG_BREAKPOINT: return "breakpoint";
+	case CHIP8_DEBUG_WATCHPOINT: return "watchpoint";
+	case CHIP8_DEBUG_STEPPED:    return "stepped";
+	}
+	return "?";
+}
+
+int chip8_debug_command(chip8_t *c, const char *line, char *out, u32 size) {
+	enum { MAX_TOKENS = 8 };
+	char buf[128];
+	char *tok[MAX_TOKENS];
+	int count = 0;
+	u32 len = 0;
+
+	out[0] = '\0';
+	snprintf(buf, sizeof(buf), "%s", line);
+	for (char *t = strtok(buf, " \t\r\n"); t && count < MAX_TOKENS; t = strtok(NULL, " \t\r\n"))
+		tok[count++] = t;
+
+	if (count == 0)
+		return 0;
+
+	const char *cmd = tok[0];
+	u16 arg1 = count > 1 ? (u16)strtoul(tok[1], NULL, 16) : 0;
+
+	if (!strcmp(cmd, "b") && (count == 2 || count == 5)) {
+		if (count == 5) {
+			int reg = parse_reg(tok[2]);
+			int cmp = parse_cmp(tok[3]);
+			if (reg < 0 || reg > 0xF || cmp < 0)
+				goto invalid;
+			if (chip8_debug_add_condition(c, arg1, (u8)reg, (chip8_cmp_t)cmp, (u8)strtoul(tok[4], NULL, 0)))
+				goto invalid;
+		}
+		else {
+			chip8_debug_set_breakpoint(c, arg1, 1);
+		}
+		append(out, size, &len, "breakpoint at %03x\n", arg1);
+	}
+	else if (!strcmp(cmd, "bd") && count == 2) {
+		chip8_debug_set_breakpoint(c, arg1, 0);
+		append(out, size, &len, "deleted breakpoint at %03x\n", arg1);
+	}
+	else if ((!strcmp(cmd, "w") && count >= 3) || (!strcmp(cmd, "wd") && count >= 2)) {
+		u8 flags = 0;
+		int at = 1;
+		if (!strcmp(cmd, "w")) {
+			flags |= strchr(tok[1], 'r') ? CHIP8_WATCH_READ : 0;
+			flags |= strchr(tok[1], 'w') ? CHIP8_WATCH_WRITE : 0;
+			at = 2;
+		}
+		u16 address = (u16)strtoul(tok[at], NULL, 16);
+		u16 length = count > at + 1 ? (u16)strtoul(tok[at + 1], NULL, 0) : 1;
+		chip8_debug_set_watchpoint(c, address, length, flags);
+		append(out, size, &len, "watch %03x-%03x %s%s\n", address, address + length - 1,
+			flags & CHIP8_WATCH_READ ? "r" : "", flags & CHIP8_WATCH_WRITE ? "w" : "-");
+	}
+	else if (!strcmp(cmd, "wr") && count != 2) {
+		u8 flags = 0;
+		u32 mask = 0;
+		if (count > 1) {
+			flags |= strchr(tok[1], 'r') ? CHIP8_WATCH_READ : 0;
+			flags |= strchr(tok[1], 'w') ? CHIP8_WATCH_WRITE : 0;
+		}
+		for (int i = 2; i < count; ++i) {
+			int reg = parse_reg(tok[i]);
+			if (reg < 0)
+				goto invalid;
+			mask |= 1u << reg;
+		}
+		chip8_debug_set_reg_watch(c, mask, flags);
+		append(out, size, &len, "register watch %05x %s%s\n", mask,
+			flags & CHIP8_WATCH_READ ? "r" : "", flags & CHIP8_WATCH_WRITE ? "w" : "-");
+	}
+	else if (!strcmp(cmd, "clear")) {
+		chip8_debug_clear_all(c);
+		append(out, size, &len, "cleared\n");
+	}
+	else if (!strcmp(cmd, "c")) {
+		chip8_debug_continue(c);
+	}
+	else if (!strcmp(cmd, "p")) {
+		chip8_debug_pause(c);
+	}
+	else if (!strcmp(cmd, "s")) {
+		chip8_debug_step(c);
+	}
+	else if (!strcmp(cmd, "n")) {
+		chip8_debug_step_over(c);
+	}
+	else if (!strcmp(cmd, "r")) {
+		chip8_cpu_state_t cpu;
+		chip8_get_cpu_state(c, &cpu);
+		for (u8 i = 0; i < 16; ++i)
+			append(out, size, &len, "V%X=%02x%c", i, cpu.registers[i], i == 7 || i == 15 ? '\n' : ' ');
+		append(out, size, &len, "PC=%03x I=%03x SP=%x DT=%02x ST=%02x [%s]\n",
+			cpu.pc, cpu.index, cpu.sp, cpu.delay_timer, cpu.sound_timer, state_name(chip8_debug_state(c)));
+	}
+	else if (!strcmp(cmd, "x") && count >= 2) {
+		u16 length = count > 2 ? (u16)strtoul(tok[2], NULL, 0) : 16;
+		for (u16 i = 0; i < length; ++i) {
+			if (i % 16 == 0)
+				append(out, size, &len, "%03x:", (arg1 + i) & 0xFFF);
+			append(out, size, &len, " %02x%s", chip8_peek(c, arg1 + i), i % 16 == 15 || i + 1 == length ? "\n" : "");
+		}
+	}
+	else if (!strcmp(cmd, "d")) {
+		chip8_cpu_state_t cpu;
+		chip8_get_cpu_state(c, &cpu);
+		u16 address = count > 1 ? arg1 : cpu.pc;
+		u16 lines = count > 2 ? (u16)strtoul(tok[2], NULL, 0) : 8;
+		for (u16 i = 0; i < lines; ++i, address += 2) {
+			char text[32];
+			u16 opcode = (chip8_peek(c, address) << 8) | chip8_peek(c, address + 1);
+			chip8_disasm(opcode, text, sizeof(text));
+			append(out, size, &len, "%c%03x  %04x  %s\n", address == cpu.pc ? '>' : ' ', address, opcode, text);
+		}
+	}
+	else {
+		goto invalid;
+	}
+
+	return 0;
+
+invalid:
+	append(out, size, &len, "invalid command: %s\n", line);
+	return -1;
+}
@@ -0,0 +1,78 @@
+#ifndef CHIP8_DEBUG_H
+#define CHIP8_DEBUG_H
+
+#include "types.h"
+#include "chip8.h"
+
+/* Debugger for the chip8 core.
+ * Breakpoints and memory watchpoints are kept in 4096-bit bitmaps,
+ * the core only calls into the debugger while c->debug_armed is set,
+ * which is the case only while something is armed (a breakpoint, a
+ * watchpoint, a pending step) or execution is paused.
+ * The debugger state is allocated on the first call that needs it.
+ */
+
+enum {
+	CHIP8_WATCH_READ  = 1 << 0,
+	CHIP8_WATCH_WRITE = 1 << 1,
+
+	CHIP8_WATCH_REG_I = 16, // bit of the I register in register watch masks
+};
+
+typedef enum {
+	CHIP8_CMP_EQ,
+	CHIP8_CMP_NE,
+	CHIP8_CMP_LT,
+	CHIP8_CMP_GT,
+} chip8_cmp_t;
+
+typedef enum {
+	CHIP8_DEBUG_RUNNING,
+	CHIP8_DEBUG_PAUSED,      // paused by the user
+	CHIP8_DEBUG_BREAKPOINT,  // stopped before executing a breakpoint
+	CHIP8_DEBUG_WATCHPOINT,  // stopped after a watched access
+	CHIP8_DEBUG_STEPPED,     // stopped after a step / step over
+} chip8_debug_state_t;
+
+// == control =================================================
+
+void chip8_debug_detach(chip8_t *c);
+
+void chip8_debug_set_breakpoint(chip8_t *c, u16 address, u8 enabled);
+// conditional breakpoint, triggers when Vreg <cmp> value. conditions at one
+// address are ORed, a plain breakpoint at the same address always triggers
+int  chip8_debug_add_condition(chip8_t *c, u16 address, u8 reg, chip8_cmp_t cmp, u8 value);
+void chip8_debug_set_watchpoint(chip8_t *c, u16 address, u16 length, u8 flags);
+// watches reads and/or writes of the registers in mask (bit n for Vn,
+// CHIP8_WATCH_REG_I for I), replaces the previous register watch
+void chip8_debug_set_reg_watch(chip8_t *c, u32 mask, u8 flags);
+void chip8_debug_clear_all(chip8_t *c);
+
+void chip8_debug_pause(chip8_t *c);
+void chip8_debug_continue(chip8_t *c);
+void chip8_debug_step(chip8_t *c);
+void chip8_debug_step_over(chip8_t *c);
+
+chip8_debug_state_t chip8_debug_state(const chip8_t *c);
+u16  chip8_debug_stop_address(const chip8_t *c);
+u16  chip8_debug_watch_address(const chip8_t *c); // address of the last watched access
+
+// runs a textual debugger command (see chip8_debug.c for the syntax),
+// the reply is written to out. returns -1 for unknown/invalid commands
+int  chip8_debug_command(chip8_t *c, const char *line, char *out, u32 size);
+
+// == hooks called by the core, only while c->debug_armed ====
+
+// returns 1 if the instruction at pc must not be executed
+int  chip8_debug_before_step(chip8_t *c);
+void chip8_debug_after_step(chip8_t *c, u16 pc);
+void chip8_debug_on_read(chip8_t *c, u16 address);
+void chip8_debug_on_write(chip8_t *c, u16 address);
+
+// == local socket front-end, debugs a single instance =======
+
+int  chip8_debug_listen(chip8_t *c, u16 port);
+void chip8_debug_poll();
+void chip8_debug_close();
+
+#endif
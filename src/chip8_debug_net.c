@@ -0,0 +1,193 @@
+#include "chip8_debug.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Line based debugger front-end on a loopback TCP socket, e.g.
+ *   nc 127.0.0.1 <port>
+ * every line is passed to chip8_debug_command, the client is notified
+ * when execution stops. Polled once per frame, never blocks.
+ */
+
+#if (defined(__unix__) || defined(__APPLE__)) && !defined(__EMSCRIPTEN__)
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// a closed client must not raise SIGPIPE, macOS only has the socket option
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+enum { OUT_BUFFER_SIZE = 16384 };
+
+static struct {
+	int listen_fd;
+	int client_fd;
+	char line[256];
+	u32 line_len;
+	char out[OUT_BUFFER_SIZE]; // replies the socket hasn't taken yet
+	u32 out_len;
+	chip8_debug_state_t reported;
+	chip8_t *target;
+} net = {
+	.listen_fd = -1,
+	.client_fd = -1,
+};
+
+static void drop_client(void) {
+	close(net.client_fd);
+	net.client_fd = -1;
+	net.line_len = 0;
+	net.out_len = 0;
+}
+
+// sends as much of the output as the socket takes, drops a closed client
+static void flush(void) {
+	while (net.client_fd >= 0 && net.out_len) {
+		ssize_t sent = send(net.client_fd, net.out, net.out_len, SEND_FLAGS);
+		if (sent < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				drop_client();
+			return;
+		}
+		memmove(net.out, net.out + sent, net.out_len - (u32)sent);
+		net.out_len -= (u32)sent;
+	}
+}
+
+static void send_str(const char *str) {
+	u32 len = (u32)strlen(str);
+
+	if (net.client_fd < 0)
+		return;
+	// a client that stopped reading isn't worth blocking for
+	if (net.out_len + len > OUT_BUFFER_SIZE) {
+		drop_client();
+		return;
+	}
+	memcpy(net.out + net.out_len, str, len);
+	net.out_len += len;
+	flush();
+}
+
+int chip8_debug_listen(chip8_t *c, u16 port) {
+	int status = -1;
+
+	chip8_debug_close();
+	net.target = c;
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		PANIC("couldn't create debugger socket", failed_socket);
+
+	int yes = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1))
+		PANIC("couldn't bind debugger socket", failed_bind);
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	net.listen_fd = fd;
+	printf("debugger listening on 127.0.0.1:%u\n", port);
+	return 0;
+
+failed_bind:
+	close(fd);
+failed_socket:
+	return status;
+}
+
+void chip8_debug_poll() {
+	if (net.listen_fd < 0)
+		return;
+
+	if (net.client_fd < 0) {
+		net.client_fd = accept(net.listen_fd, NULL, NULL);
+		if (net.client_fd < 0)
+			return;
+		fcntl(net.client_fd, F_SETFL, fcntl(net.client_fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+		int yes = 1;
+		setsockopt(net.client_fd, SOL_SOCKET, SO_NOSIGPIPE, &yes, sizeof(yes));
+#endif
+		net.reported = chip8_debug_state(net.target);
+		send_str("chip8 debugger\n> ");
+	}
+
+	// the rest of earlier replies
+	flush();
+	if (net.client_fd < 0)
+		return;
+
+	char buf[256];
+	ssize_t received;
+	while ((received = recv(net.client_fd, buf, sizeof(buf), 0)) > 0) {
+		for (ssize_t i = 0; i < received && net.client_fd >= 0; ++i) {
+			if (buf[i] != '\n') {
+				if (net.line_len < sizeof(net.line) - 1)
+					net.line[net.line_len++] = buf[i];
+				continue;
+			}
+
+			char reply[2048];
+			net.line[net.line_len] = '\0';
+			net.line_len = 0;
+			chip8_debug_command(net.target, net.line, reply, sizeof(reply));
+			send_str(reply);
+			send_str("> ");
+		}
+		if (net.client_fd < 0)
+			return;
+	}
+
+	if (received == 0 || (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+		drop_client();
+		return;
+	}
+
+	// notify the client when execution stops
+	chip8_debug_state_t state = chip8_debug_state(net.target);
+	if (state != net.reported && state != CHIP8_DEBUG_RUNNING) {
+		char msg[64];
+		if (state == CHIP8_DEBUG_WATCHPOINT)
+			snprintf(msg, sizeof(msg), "\nwatchpoint %03x hit at %03x\n> ", chip8_debug_watch_address(net.target), chip8_debug_stop_address(net.target));
+		else
+			snprintf(msg, sizeof(msg), "\nstopped at %03x\n> ", chip8_debug_stop_address(net.target));
+		send_str(msg);
+	}
+	net.reported = state;
+}
+
+void chip8_debug_close() {
+	if (net.client_fd >= 0)
+		drop_client();
+	if (net.listen_fd >= 0)
+		close(net.listen_fd);
+	net.listen_fd = -1;
+}
+
+#else
+
+int chip8_debug_listen(chip8_t *c, u16 port) {
+	(void)c; (void)port;
+	puts("ERROR: the debugger socket isn't supported on this platform\n");
+	return -1;
+}
+
+void chip8_debug_poll() {}
+void chip8_debug_close() {}
+
+#endif
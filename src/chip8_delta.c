@@ -0,0 +1,92 @@
+#include "chip8_delta.h"
+
+static void frame_to_bytes(const u64 *rows, u8 *out) {
+	for (u32 row = 0; row < CHIP8_DELTA_ROWS; ++row) {
+		for (u32 i = 0; i < 8; ++i)
+			out[row * 8 + i] = (u8)(rows[row] >> (56 - i * 8));
+	}
+}
+
+u32 chip8_delta_put_varint(u8 *out, u32 value) {
+	u32 len = 0;
+	while (value >= 0x80) {
+		out[len++] = (u8)(value | 0x80);
+		value >>= 7;
+	}
+	out[len++] = (u8)value;
+	return len;
+}
+
+u32 chip8_delta_get_varint(const u8 *in, u32 size, u32 *value) {
+	*value = 0;
+	for (u32 i = 0; i < size && i < 5; ++i) {
+		*value |= (u32)(in[i] & 0x7F) << (7 * i);
+		if (!(in[i] & 0x80))
+			return i + 1;
+	}
+	return 0;
+}
+
+u32 chip8_delta_encode(const u64 *prev, const u64 *rows, u8 *out) {
+	u64 diff[CHIP8_DELTA_ROWS];
+	u8 bytes[CHIP8_DELTA_FRAME_SIZE];
+	u32 len = 0;
+	u32 pos = 0;
+
+	for (u32 row = 0; row < CHIP8_DELTA_ROWS; ++row)
+		diff[row] = prev[row] ^ rows[row];
+	frame_to_bytes(diff, bytes);
+
+	while (pos < CHIP8_DELTA_FRAME_SIZE) {
+		u32 zeros = 0;
+		while (pos + zeros < CHIP8_DELTA_FRAME_SIZE && !bytes[pos + zeros])
+			++zeros;
+		len += chip8_delta_put_varint(out + len, zeros);
+		pos += zeros;
+
+		if (pos == CHIP8_DELTA_FRAME_SIZE)
+			break;
+
+		// literals end at the first run of two zero bytes
+		u32 literals = 0;
+		while (pos + literals < CHIP8_DELTA_FRAME_SIZE) {
+			if (!bytes[pos + literals] && (pos + literals + 1 == CHIP8_DELTA_FRAME_SIZE || !bytes[pos + literals + 1]))
+				break;
+			++literals;
+		}
+		len += chip8_delta_put_varint(out + len, literals);
+		for (u32 i = 0; i < literals; ++i)
+			out[len++] = bytes[pos++];
+	}
+
+	return len;
+}
+
+u32 chip8_delta_decode(const u8 *in, u32 size, u64 *rows) {
+	u32 len = 0;
+	u32 pos = 0;
+
+	while (pos < CHIP8_DELTA_FRAME_SIZE) {
+		u32 zeros, literals, read;
+
+		if (!(read = chip8_delta_get_varint(in + len, size - len, &zeros)))
+			return 0;
+		len += read;
+		pos += zeros;
+
+		if (pos >= CHIP8_DELTA_FRAME_SIZE)
+			break;
+
+		if (!(read = chip8_delta_get_varint(in + len, size - len, &literals)))
+			return 0;
+		len += read;
+
+		if (literals > size - len || pos + literals > CHIP8_DELTA_FRAME_SIZE)
+			return 0;
+
+		for (u32 i = 0; i < literals; ++i, ++pos)
+			rows[pos / 8] ^= (u64)in[len++] << (56 - (pos % 8) * 8);
+	}
+
+	return pos == CHIP8_DELTA_FRAME_SIZE ? len : 0;
+}
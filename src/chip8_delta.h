@@ -0,0 +1,31 @@
+#ifndef CHIP8_DELTA_H
+#define CHIP8_DELTA_H
+
+#include "types.h"
+
+/* Delta coding of bit-packed display frames (one u64 per row).
+ * A frame is XORed with the previous one and the result is run-length
+ * coded as a sequence of (zero bytes to skip, n literal bytes, literals),
+ * with both counts as LEB128 varints. Frames are serialized row by row,
+ * most significant byte first, so bytes map to 8 horizontal pixels.
+ */
+
+enum {
+	CHIP8_DELTA_ROWS = 32,
+	CHIP8_DELTA_FRAME_SIZE = CHIP8_DELTA_ROWS * sizeof(u64),
+	// worst case encoded size of a frame
+	CHIP8_DELTA_MAX_SIZE = CHIP8_DELTA_FRAME_SIZE + 8,
+};
+
+u32 chip8_delta_put_varint(u8 *out, u32 value);
+// returns the number of bytes read, 0 if the varint doesn't fit in size
+u32 chip8_delta_get_varint(const u8 *in, u32 size, u32 *value);
+
+// encodes rows against prev into out (at least CHIP8_DELTA_MAX_SIZE
+// bytes), returns the encoded size
+u32 chip8_delta_encode(const u64 *prev, const u64 *rows, u8 *out);
+// applies an encoded delta to rows in place, returns the number of bytes
+// consumed or 0 if the data is corrupt
+u32 chip8_delta_decode(const u8 *in, u32 size, u64 *rows);
+
+#endif
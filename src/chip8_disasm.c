@@ -0,0 +1,120 @@
+#include "chip8_disasm.h"
+
+#include <stdio.h>
+
+int chip8_disasm(u16 opcode, char *buf, u32 size) {
+	u8 x    = (opcode & 0x0F00) >> 8;
+	u8 y    = (opcode & 0x00F0) >> 4;
+	u8 n    =  opcode & 0x000F;
+	u8 kk   =  opcode & 0x00FF;
+	u16 nnn =  opcode & 0x0FFF;
+
+	switch (opcode >> 12) {
+	case 0x0:
+		if (opcode == 0x00E0) return snprintf(buf, size, "CLS");
+		if (opcode == 0x00EE) return snprintf(buf, size, "RET");
+		break;
+	case 0x1: return snprintf(buf, size, "JP 0x%03x", nnn);
+	case 0x2: return snprintf(buf, size, "CALL 0x%03x", nnn);
+	case 0x3: return snprintf(buf, size, "SE V%X, 0x%02x", x, kk);
+	case 0x4: return snprintf(buf, size, "SNE V%X, 0x%02x", x, kk);
+	case 0x5: return snprintf(buf, size, "SE V%X, V%X", x, y);
+	case 0x6: return snprintf(buf, size, "LD V%X, 0x%02x", x, kk);
+	case 0x7: return snprintf(buf, size, "ADD V%X, 0x%02x", x, kk);
+	case 0x8:
+		switch (n) {
+		case 0x0: return snprintf(buf, size, "LD V%X, V%X", x, y);
+		case 0x1: return snprintf(buf, size, "OR V%X, V%X", x, y);
+		case 0x2: return snprintf(buf, size, "AND V%X, V%X", x, y);
+		case 0x3: return snprintf(buf, size, "XOR V%X, V%X", x, y);
+		case 0x4: return snprintf(buf, size, "ADD V%X, V%X", x, y);
+		case 0x5: return snprintf(buf, size, "SUB V%X, V%X", x, y);
+		case 0x6: return snprintf(buf, size, "SHR V%X", x);
+		case 0x7: return snprintf(buf, size, "SUBN V%X, V%X", x, y);
+		case 0xE: return snprintf(buf, size, "SHL V%X", x);
+		}
+		break;
+	case 0x9: return snprintf(buf, size, "SNE V%X, V%X", x, y);
+	case 0xA: return snprintf(buf, size, "LD I, 0x%03x", nnn);
+	case 0xB: return snprintf(buf, size, "JP V0, 0x%03x", nnn);
+	case 0xC: return snprintf(buf, size, "RND V%X, 0x%02x", x, kk);
+	case 0xD: return snprintf(buf, size, "DRW V%X, V%X, %u", x, y, n);
+	case 0xE:
+		if (kk == 0x9E) return snprintf(buf, size, "SKP V%X", x);
+		if (kk == 0xA1) return snprintf(buf, size, "SKNP V%X", x);
+		break;
+	case 0xF:
+		switch (kk) {
+		case 0x07: return snprintf(buf, size, "LD V%X, DT", x);
+		case 0x0A: return snprintf(buf, size, "LD V%X, K", x);
+		case 0x15: return snprintf(buf, size, "LD DT, V%X", x);
+		case 0x18: return snprintf(buf, size, "LD ST, V%X", x);
+		case 0x1E: return snprintf(buf, size, "ADD I, V%X", x);
+		case 0x29: return snprintf(buf, size, "LD F, V%X", x);
+		case 0x33: return snprintf(buf, size, "LD B, V%X", x);
+		case 0x55: return snprintf(buf, size, "LD [I], V%X", x);
+		case 0x65: return snprintf(buf, size, "LD V%X, [I]", x);
+		}
+		break;
+	}
+
+	return snprintf(buf, size, "DW 0x%04x", opcode);
+}
+
+int chip8_disasm_dest_reg(u16 opcode) {
+	u8 x = (opcode & 0x0F00) >> 8;
+
+	switch (opcode >> 12) {
+	case 0x6: case 0x7: case 0x8: case 0xC:
+		return x;
+	case 0xF:
+		if ((opcode & 0x00FF) == 0x07 || (opcode & 0x00FF) == 0x0A)
+			return x;
+		break;
+	}
+
+	return -1;
+}
+
+void chip8_disasm_reg_access(u16 opcode, u32 *read, u32 *written) {
+	enum { I = 1u << 16, VF = 1u << 0xF };
+	u8 x = (opcode & 0x0F00) >> 8;
+	u8 y = (opcode & 0x00F0) >> 4;
+	u32 vx = 1u << x;
+	u32 vy = 1u << y;
+	u32 r = 0;
+	u32 w = 0;
+
+	switch (opcode >> 12) {
+	case 0x3: case 0x4: r = vx; break;
+	case 0x5: case 0x9: r = vx | vy; break;
+	case 0x6: case 0xC: w = vx; break;
+	case 0x7: r = vx; w = vx; break;
+	case 0x8:
+		switch (opcode & 0x000F) {
+		case 0x0: r = vy; w = vx; break;
+		case 0x1: case 0x2: case 0x3: r = vx | vy; w = vx; break;
+		case 0x4: case 0x5: case 0x7: r = vx | vy; w = vx | VF; break;
+		case 0x6: case 0xE: r = vx; w = vx | VF; break;
+		}
+		break;
+	case 0xA: w = I; break;
+	case 0xB: r = 1u << 0; break;
+	case 0xD: r = vx | vy | I; w = VF; break;
+	case 0xE: r = vx; break;
+	case 0xF:
+		switch (opcode & 0x00FF) {
+		case 0x07: case 0x0A: w = vx; break;
+		case 0x15: case 0x18: r = vx; break;
+		case 0x1E: r = vx | I; w = I; break;
+		case 0x29: r = vx; w = I; break;
+		case 0x33: r = vx | I; break;
+		case 0x55: r = ((vx << 1) - 1) | I; break;
+		case 0x65: r = I; w = (vx << 1) - 1; break;
+		}
+		break;
+	}
+
+	*read = r;
+	*written = w;
+}
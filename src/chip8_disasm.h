@@ -0,0 +1,19 @@
+#ifndef CHIP8_DISASM_H
+#define CHIP8_DISASM_H
+
+#include "types.h"
+
+// writes the mnemonic of opcode into buf (e.g. "LD V3, 0x12"),
+// returns the number of characters written like snprintf
+int chip8_disasm(u16 opcode, char *buf, u32 size);
+
+// returns the register written by opcode (0x0 - 0xF), or -1 if the
+// instruction doesn't write a general purpose register
+int chip8_disasm_dest_reg(u16 opcode);
+
+// registers read and written by opcode as masks, bit n for Vn and
+// bit 16 for I, with the default quirks of the core. Fx0A only writes
+// Vx once a key is pressed.
+void chip8_disasm_reg_access(u16 opcode, u32 *read, u32 *written);
+
+#endif
@@ -0,0 +1,50 @@
+#include "chip8_phosphor.h"
+
+#include <string.h>
+
+void chip8_phosphor_init(chip8_phosphor_t *p, chip8_phosphor_mode_t mode, u8 frames) {
+	memset(p, 0, sizeof(*p));
+	p->mode = mode;
+
+	if (frames < 1)
+		frames = 1;
+	if (frames > CHIP8_PHOSPHOR_MAX_FRAMES)
+		frames = CHIP8_PHOSPHOR_MAX_FRAMES;
+	p->frames = frames;
+}
+
+void chip8_phosphor_apply(chip8_phosphor_t *p, const u64 *display, u64 *hi, u64 *lo) {
+	switch (p->mode) {
+	case CHIP8_PHOSPHOR_BLEND:
+		memcpy(p->history[p->head], display, sizeof(p->history[0]));
+		p->head = (p->head + 1) % p->frames;
+
+		for (u8 row = 0; row < CHIP8_PHOSPHOR_ROWS; ++row) {
+			u64 lit = 0;
+			for (u8 frame = 0; frame < p->frames; ++frame)
+				lit |= p->history[frame][row];
+			hi[row] = lo[row] = lit;
+		}
+		break;
+
+	case CHIP8_PHOSPHOR_DECAY:
+		for (u8 row = 0; row < CHIP8_PHOSPHOR_ROWS; ++row) {
+			/* saturating decrement of every 2-bit counter:
+			 * 11 -> 10 -> 01 -> 00, lit pixels go back to 11
+			 */
+			u64 h = p->level_hi[row];
+			u64 l = p->level_lo[row];
+			u64 lit = display[row];
+			p->level_hi[row] = (h & l) | lit;
+			p->level_lo[row] = (h & ~l) | lit;
+			hi[row] = p->level_hi[row];
+			lo[row] = p->level_lo[row];
+		}
+		break;
+
+	default:
+		memcpy(hi, display, sizeof(u64) * CHIP8_PHOSPHOR_ROWS);
+		memcpy(lo, display, sizeof(u64) * CHIP8_PHOSPHOR_ROWS);
+		break;
+	}
+}
@@ -0,0 +1,38 @@
+#ifndef CHIP8_PHOSPHOR_H
+#define CHIP8_PHOSPHOR_H
+
+#include "types.h"
+
+/* Presentation stage between the emulated display and the screen,
+ * hides the flicker caused by sprites being XOR-erased and redrawn.
+ * Works directly on the bit-packed display (one u64 per row, MSB is
+ * the leftmost pixel), so a frame costs a few word operations per row.
+ * The output is a 2-bit brightness per pixel, split in two bit planes.
+ */
+
+enum {
+	CHIP8_PHOSPHOR_ROWS = 32,
+	CHIP8_PHOSPHOR_MAX_FRAMES = 8,
+};
+
+typedef enum {
+	CHIP8_PHOSPHOR_OFF,    // present the raw display
+	CHIP8_PHOSPHOR_BLEND,  // OR of the last n frames
+	CHIP8_PHOSPHOR_DECAY,  // pixels fade out over 3 frames once turned off
+	CHIP8_PHOSPHOR_COUNT,
+} chip8_phosphor_mode_t;
+
+typedef struct {
+	chip8_phosphor_mode_t mode;
+	u8 frames;
+	u8 head;
+	u64 history[CHIP8_PHOSPHOR_MAX_FRAMES][CHIP8_PHOSPHOR_ROWS];
+	// bit-sliced 2-bit brightness counter of every pixel
+	u64 level_hi[CHIP8_PHOSPHOR_ROWS];
+	u64 level_lo[CHIP8_PHOSPHOR_ROWS];
+} chip8_phosphor_t;
+
+void chip8_phosphor_init(chip8_phosphor_t *p, chip8_phosphor_mode_t mode, u8 frames);
+void chip8_phosphor_apply(chip8_phosphor_t *p, const u64 *display, u64 *hi, u64 *lo);
+
+#endif
@@ -0,0 +1,109 @@
+#include "chip8_sokol.h"
+
+#include <sokol/sokol.h>
+
+static struct {
+	chip8_phosphor_t phosphor;
+	u32 pixels[CHIP8_DISPLAY_HEIGHT][CHIP8_DISPLAY_WIDTH];
+	sg_image sokol_img;
+	u64 uploaded;
+} screen;
+
+static inline void update_screen(const chip8_t *c);
+
+void chip8_render_init() {
+	chip8_phosphor_init(&screen.phosphor, CHIP8_PHOSPHOR_OFF, 1);
+
+	// Chip8 display init
+	screen.sokol_img = sg_make_image(&(sg_image_desc) {
+		.width = CHIP8_DISPLAY_WIDTH,
+		.height = CHIP8_DISPLAY_HEIGHT,
+		.pixel_format = SG_PIXELFORMAT_RGBA8,
+		.usage = SG_USAGE_DYNAMIC
+	});
+}
+
+void chip8_render(const chip8_t *c) {
+	update_screen(c);
+
+	sgl_enable_texture();
+	sgl_texture(screen.sokol_img);
+
+	sgl_push_matrix();
+		sgl_scale(0.75f, 0.75f, 1.f);
+		sgl_begin_quads();
+			sgl_v2f_t2f(-1.f, -1.f, 0.f, 1.f);
+			sgl_v2f_t2f(-1.f,  1.f, 0.f, 0.f);
+			sgl_v2f_t2f( 1.f,  1.f, 1.f, 0.f);
+			sgl_v2f_t2f( 1.f, -1.f, 1.f, 1.f);
+		sgl_end();
+	sgl_pop_matrix();
+}
+
+void chip8_render_cleanup() {
+	sg_destroy_image(screen.sokol_img);
+}
+
+u64 chip8_render_uploaded() {
+	return screen.uploaded;
+}
+
+void chip8_set_phosphor(chip8_phosphor_mode_t mode, u8 frames) {
+	chip8_phosphor_init(&screen.phosphor, mode, frames);
+}
+
+void chip8_input_event(chip8_t *c, const sapp_event *e) {
+	if (e->type == SAPP_EVENTTYPE_KEY_DOWN || e->type == SAPP_EVENTTYPE_KEY_UP) {
+		u8 is_down = e->type == SAPP_EVENTTYPE_KEY_DOWN;
+		switch (e->key_code) {
+		case SAPP_KEYCODE_X: chip8_input(c, 0, is_down); break;
+		case SAPP_KEYCODE_1: chip8_input(c, 1, is_down); break;
+		case SAPP_KEYCODE_2: chip8_input(c, 2, is_down); break;
+		case SAPP_KEYCODE_3: chip8_input(c, 3, is_down); break;
+
+		case SAPP_KEYCODE_Q: chip8_input(c, 4, is_down); break;
+		case SAPP_KEYCODE_W: chip8_input(c, 5, is_down); break;
+		case SAPP_KEYCODE_E: chip8_input(c, 6, is_down); break;
+
+		case SAPP_KEYCODE_A: chip8_input(c, 7, is_down); break;
+		case SAPP_KEYCODE_S: chip8_input(c, 8, is_down); break;
+		case SAPP_KEYCODE_D: chip8_input(c, 9, is_down); break;
+
+		case SAPP_KEYCODE_Z: chip8_input(c, 10, is_down); break;
+		case SAPP_KEYCODE_C: chip8_input(c, 11, is_down); break;
+
+		case SAPP_KEYCODE_4: chip8_input(c, 12, is_down); break;
+		case SAPP_KEYCODE_R: chip8_input(c, 13, is_down); break;
+		case SAPP_KEYCODE_F: chip8_input(c, 14, is_down); break;
+		case SAPP_KEYCODE_V: chip8_input(c, 15, is_down); break;
+
+		default: break;
+		}
+	}
+}
+
+static inline void update_screen(const chip8_t *c) {
+	// brightness levels of the phosphor stage, as RGBA8
+	static const u32 palette[4] = { 0x00000000, 0xff555555, 0xffaaaaaa, 0xffffffff };
+	u64 hi[CHIP8_DISPLAY_HEIGHT];
+	u64 lo[CHIP8_DISPLAY_HEIGHT];
+
+	chip8_phosphor_apply(&screen.phosphor, c->display, hi, lo);
+
+	// expand the bit-packed rows
+	for (u8 y = 0; y < CHIP8_DISPLAY_HEIGHT; ++y) {
+		for (u8 x = 0; x < CHIP8_DISPLAY_WIDTH; ++x) {
+			u8 shift = CHIP8_DISPLAY_WIDTH - 1 - x;
+			u8 level = (((hi[y] >> shift) & 1) << 1) | ((lo[y] >> shift) & 1);
+			screen.pixels[y][x] = palette[level];
+		}
+	}
+
+	sg_update_image(screen.sokol_img, &(sg_image_data) {
+		.subimage[0][0] = {
+			.ptr = screen.pixels,
+			.size = sizeof(screen.pixels)
+		}
+	});
+	screen.uploaded += sizeof(screen.pixels);
+}
@@ -0,0 +1,21 @@
+#ifndef CHIP8_SOKOL_FRONTEND_H
+#define CHIP8_SOKOL_FRONTEND_H
+
+#include "chip8.h"
+#include "chip8_phosphor.h"
+
+/* sokol front-end of the core: draws the display and maps the keyboard
+ * to the keypad. Renders a single instance.
+ */
+
+typedef struct sapp_event sapp_event;
+
+void chip8_render_init();
+void chip8_render(const chip8_t *c);
+void chip8_render_cleanup();
+// total bytes uploaded to the display texture
+u64  chip8_render_uploaded();
+void chip8_set_phosphor(chip8_phosphor_mode_t mode, u8 frames);
+void chip8_input_event(chip8_t *c, const sapp_event *e);
+
+#endif
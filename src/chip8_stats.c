@@ -0,0 +1,42 @@
+#include "chip8_stats.h"
+
+#include <stdio.h>
+
+void chip8_stats_diff(const chip8_stats_t *now, const chip8_stats_t *then, chip8_stats_t *interval) {
+	interval->time_ns          = now->time_ns          - then->time_ns;
+	interval->instructions     = now->instructions     - then->instructions;
+	interval->frames_emulated  = now->frames_emulated  - then->frames_emulated;
+	interval->frames_presented = now->frames_presented - then->frames_presented;
+	interval->frames_dropped   = now->frames_dropped   - then->frames_dropped;
+	interval->capture_dropped  = now->capture_dropped  - then->capture_dropped;
+	interval->texture_bytes    = now->texture_bytes    - then->texture_bytes;
+	interval->update_ns        = now->update_ns        - then->update_ns;
+	interval->render_ns        = now->render_ns        - then->render_ns;
+	interval->commit_ns        = now->commit_ns        - then->commit_ns;
+}
+
+double chip8_stats_rate(const chip8_stats_t *interval, u64 counter) {
+	return interval->time_ns ? counter * 1e9 / interval->time_ns : 0.0;
+}
+
+static double per_frame_us(const chip8_stats_t *interval, u64 ns) {
+	return interval->frames_presented ? ns / 1e3 / interval->frames_presented : 0.0;
+}
+
+int chip8_stats_format_json(const chip8_stats_t *interval, char *buf, u32 size) {
+	return snprintf(buf, size,
+		"{\"interval_ms\":%.1f,\"instructions_per_sec\":%.0f,"
+		"\"frames_emulated\":%llu,\"frames_presented\":%llu,\"frames_dropped\":%llu,"
+		"\"capture_dropped\":%llu,\"texture_bytes_per_sec\":%.0f,"
+		"\"update_us\":%.1f,\"render_us\":%.1f,\"commit_us\":%.1f}",
+		interval->time_ns / 1e6,
+		chip8_stats_rate(interval, interval->instructions),
+		(unsigned long long)interval->frames_emulated,
+		(unsigned long long)interval->frames_presented,
+		(unsigned long long)interval->frames_dropped,
+		(unsigned long long)interval->capture_dropped,
+		chip8_stats_rate(interval, interval->texture_bytes),
+		per_frame_us(interval, interval->update_ns),
+		per_frame_us(interval, interval->render_ns),
+		per_frame_us(interval, interval->commit_ns));
+}
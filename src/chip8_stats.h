@@ -0,0 +1,36 @@
+#ifndef CHIP8_STATS_H
+#define CHIP8_STATS_H
+
+#include "types.h"
+
+/* Performance counters of a host running the core. The host keeps a
+ * running total, filled from its own timers and c->instructions, and
+ * diffs two snapshots to get the numbers for an interval.
+ */
+
+typedef struct {
+	u64 time_ns;          // wall time covered
+	u64 instructions;     // guest instructions executed
+	u64 frames_emulated;  // host frames that executed at least one instruction
+	u64 frames_presented; // host frames submitted to the gpu
+	u64 frames_dropped;   // display refreshes the host missed
+	u64 capture_dropped;  // frames the capture writer skipped
+	u64 texture_bytes;    // bytes uploaded to the display texture
+	u64 update_ns;        // time spent running the core
+	u64 render_ns;        // time spent building the frame
+	u64 commit_ns;        // time spent submitting it (sgl_draw, sg_commit)
+} chip8_stats_t;
+
+// interval = now - then, field by field
+void chip8_stats_diff(const chip8_stats_t *now, const chip8_stats_t *then, chip8_stats_t *interval);
+
+// per second value of a counter over an interval
+double chip8_stats_rate(const chip8_stats_t *interval, u64 counter);
+
+/* writes an interval as a single line of JSON (no newline), rates are
+ * per second and times are average microseconds per presented frame.
+ * returns the number of characters written like snprintf
+ */
+int chip8_stats_format_json(const chip8_stats_t *interval, char *buf, u32 size);
+
+#endif
@@ -0,0 +1,78 @@
+#include "chip8_trace.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+chip8_trace_t *chip8_trace_create(u32 size_log2) {
+	if (size_log2 > CHIP8_TRACE_MAX_BITS)
+		PANIC("trace size out of range", failed_size);
+
+	chip8_trace_t *trace = (chip8_trace_t *)calloc(1, sizeof(chip8_trace_t));
+	if (!trace)
+		PANIC("couldn't allocate trace", failed_trace);
+
+	trace->entries = (chip8_trace_entry_t *)calloc((size_t)1 << size_log2, sizeof(chip8_trace_entry_t));
+	if (!trace->entries)
+		PANIC("couldn't allocate trace buffer", failed_entries);
+
+	trace->mask = ((u32)1 << size_log2) - 1;
+	return trace;
+
+failed_entries:
+	free(trace);
+failed_trace:
+failed_size:
+	return NULL;
+}
+
+int chip8_trace_dump(const chip8_trace_t *trace, const char *fname) {
+	/* file layout, all values little endian:
+	 * "C8TR", u32 version, u32 entry count, u64 total executed
+	 * followed by the entries from oldest to newest:
+	 * u16 pc, u16 opcode, u16 I, u8 Vx, u8 VF
+	 */
+	int status = -1;
+
+	u64 size = (u64)trace->mask + 1;
+	u64 count = trace->count < size ? trace->count : size;
+	u64 first = trace->count - count;
+
+	FILE *f = fopen(fname, "wb");
+	if (!f)
+		PANIC("couldn't open trace file", failed_open);
+
+	u8 header[20] = { 'C', '8', 'T', 'R' };
+	write_u32(header + 4, CHIP8_TRACE_VERSION);
+	write_u32(header + 8, (u32)count);
+	write_u32(header + 12, (u32)trace->count);
+	write_u32(header + 16, (u32)(trace->count >> 32));
+	if (fwrite(header, sizeof(header), 1, f) != 1)
+		PANIC("couldn't write trace header", failed_write);
+
+	for (u64 i = first; i < trace->count; ++i) {
+		const chip8_trace_entry_t *e = &trace->entries[i & trace->mask];
+		u8 buf[CHIP8_TRACE_ENTRY_SIZE];
+		write_u16(buf + 0, e->pc);
+		write_u16(buf + 2, e->opcode);
+		write_u16(buf + 4, e->index);
+		buf[6] = e->vx;
+		buf[7] = e->vf;
+		if (fwrite(buf, sizeof(buf), 1, f) != 1)
+			PANIC("couldn't write trace entry", failed_write);
+	}
+
+	printf("trace: dumped %llu instructions to %s\n", (unsigned long long)count, fname);
+	status = 0;
+
+failed_write:
+	fclose(f);
+failed_open:
+	return status;
+}
+
+void chip8_trace_destroy(chip8_trace_t *trace) {
+	if (trace)
+		free(trace->entries);
+	free(trace);
+}
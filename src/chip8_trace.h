@@ -0,0 +1,48 @@
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include "types.h"
+
+// log2 of the number of entries kept in the trace ring buffer,
+// the default keeps the last ~1M instructions (8 MB).
+// build with -DCHIP8_TRACE_BITS=0 to disable tracing in the front-end
+#ifndef CHIP8_TRACE_BITS
+#define CHIP8_TRACE_BITS 20
+#endif
+
+enum {
+	CHIP8_TRACE_VERSION = 1,
+	CHIP8_TRACE_ENTRY_SIZE = 8,
+	CHIP8_TRACE_MAX_BITS = 31,
+};
+
+// one executed instruction, the state is sampled after execution
+typedef struct {
+	u16 pc;
+	u16 opcode;
+	u16 index;
+	u8 vx;   // value of the register Vx named by the opcode
+	u8 vf;
+} chip8_trace_entry_t;
+
+typedef struct chip8_trace_t {
+	chip8_trace_entry_t *entries;
+	u32 mask;
+	u64 count; // total number of recorded instructions
+} chip8_trace_t;
+
+// size_log2 is at most CHIP8_TRACE_MAX_BITS
+chip8_trace_t *chip8_trace_create(u32 size_log2);
+int  chip8_trace_dump(const chip8_trace_t *trace, const char *fname);
+void chip8_trace_destroy(chip8_trace_t *trace);
+
+static inline void chip8_trace_record(chip8_trace_t *trace, u16 pc, u16 opcode, u16 index, u8 vx, u8 vf) {
+	chip8_trace_entry_t *e = &trace->entries[trace->count++ & trace->mask];
+	e->pc = pc;
+	e->opcode = opcode;
+	e->index = index;
+	e->vx = vx;
+	e->vf = vf;
+}
+
+#endif
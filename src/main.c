@@ -1,29 +1,72 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sokol/sokol.h>
 
 #include "chip8.h"
+#include "chip8_sokol.h"
+#include "chip8_trace.h"
+#include "chip8_debug.h"
+#include "chip8_capture.h"
+#include "chip8_stats.h"
+#include "chip8_font.h"
 #include "types.h"
 
 #include "breakout-roms.h"
 
 #define ZOOM 12
 #define SPEED_MULTIPLIER 5
+#define PHOSPHOR_BLEND_FRAMES 3
+#define CAPTURE_FPS 60
+#define FRAME_TIME_SAMPLES 31 // frame times the refresh period is estimated from
+#define STATS_INTERVAL_NS 1000000000ull
+#define STATS_PIXEL 2 // size of a font pixel in the stats overlay
+#define TRACE_FILE "chip8_trace.bin" // written on a fault and with F9
 
 void init(void);
 void frame(void);
 void input(const sapp_event *e);
 void cleanup(void);
+void draw_debug_overlay(void);
+void draw_stats_overlay(void);
+void update_stats(void);
 
 static struct {
     sg_pass_action pass_action;
     sg_image img;
     sgl_pipeline pip;
     u64 last_time;
+    u64 frame_times[FRAME_TIME_SAMPLES];
+    u32 frame_time_count;
+    u64 refresh_ns; // measured display refresh period, 0 until known
+    u16 debug_port;
+    const char *capture_file;
+    chip8_capture_t *capture;
+    u64 capture_ns; // time not yet covered by captured frames
+    const char *stats_file;
+    FILE *stats_out;
+    bool show_stats;
+    u64 start_time;
+    chip8_stats_t stats;          // totals since init
+    chip8_stats_t stats_last;     // totals at the start of the interval
+    chip8_stats_t stats_interval; // last complete interval
+    chip8_phosphor_mode_t phosphor_mode;
+    chip8_t chip8;
+    chip8_trace_t *trace;
+    bool fault_reported;
 } state;
 
 sapp_desc sokol_main(int argc, char **argv) {
-    (void)argc;(void)argv;
+    // chip8 [--debug <port>] [--capture <file>] [--stats <file or ->]
+    for (int i = 1; i < argc - 1; ++i) {
+        if (!strcmp(argv[i], "--debug"))
+            state.debug_port = (u16)atoi(argv[i + 1]);
+        else if (!strcmp(argv[i], "--capture"))
+            state.capture_file = argv[i + 1];
+        else if (!strcmp(argv[i], "--stats"))
+            state.stats_file = argv[i + 1];
+    }
+
     return (sapp_desc) {
         .width = 64 * ZOOM,
         .height = 32 * ZOOM,
@@ -59,39 +102,320 @@ void init(void) {
         }
     };
 
-    chip8_init();
-    chip8_load_data(dump_breakout_ch8, sizeof(dump_breakout_ch8));
+    chip8_render_init();
+    chip8_init(&state.chip8);
+    chip8_load_data(&state.chip8, dump_breakout_ch8, sizeof(dump_breakout_ch8));
     // if (chip8_load("roms/Breakout (Brix hack) [David Winter, 1997].ch8")) {
         // printf("couldn't load chip8 cart\n");
         // exit(-1);
     // }
 
-    state.last_time = stm_now();
+#if CHIP8_TRACE_BITS > 0
+    state.trace = chip8_trace_create(CHIP8_TRACE_BITS);
+    state.chip8.trace = state.trace;
+#endif
+
+    if (state.debug_port)
+        chip8_debug_listen(&state.chip8, state.debug_port);
+
+    if (state.capture_file)
+        state.capture = chip8_capture_open(state.capture_file, CAPTURE_FPS);
+
+    // one JSON object per line, every STATS_INTERVAL_NS
+    if (state.stats_file) {
+        state.stats_out = strcmp(state.stats_file, "-") ? fopen(state.stats_file, "w") : stdout;
+        if (!state.stats_out)
+            printf("couldn't open stats file %s\n", state.stats_file);
+    }
+
+    state.start_time = stm_now();
+    state.last_time = state.start_time;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    u64 x = *(const u64 *)a;
+    u64 y = *(const u64 *)b;
+    return (x > y) - (x < y);
+}
+
+// the median of the recent frame times, so missed refreshes don't skew it
+static void update_refresh_period(u64 frame_ns) {
+    u64 sorted[FRAME_TIME_SAMPLES];
+
+    state.frame_times[state.frame_time_count++ % FRAME_TIME_SAMPLES] = frame_ns;
+    u32 count = state.frame_time_count < FRAME_TIME_SAMPLES ? state.frame_time_count : FRAME_TIME_SAMPLES;
+    if (count < FRAME_TIME_SAMPLES / 2)
+        return;
+
+    memcpy(sorted, state.frame_times, count * sizeof(u64));
+    qsort(sorted, count, sizeof(u64), compare_u64);
+    state.refresh_ns = sorted[count / 2];
 }
 
 void frame(void) {
+    u64 frame_start = stm_now();
+
+    // count the refreshes missed since the last frame
+    u64 frame_ns = stm_ns(stm_laptime(&state.last_time));
+    if (state.stats.frames_presented) {
+        update_refresh_period(frame_ns);
+        u64 refresh_ns = state.refresh_ns;
+        if (refresh_ns && frame_ns > refresh_ns * 3 / 2)
+            state.stats.frames_dropped += (frame_ns + refresh_ns / 2) / refresh_ns - 1;
+    }
+
+    chip8_debug_poll();
+
     // == update =====================
-    for(int i = 0; i < SPEED_MULTIPLIER; ++i)
-        chip8_update();
+    // the display is only presented once per frame, so only a fault or
+    // the debugger stopping ends the frame early
+    u32 budget = SPEED_MULTIPLIER;
+    u32 reason = 0;
+    while (budget && !(reason & (CHIP8_EVENT_FAULT | CHIP8_EVENT_BREAK)))
+        budget -= chip8_run(&state.chip8, budget, &reason);
+
+    // a faulted instance keeps reporting the fault, dump the trace once
+    if ((reason & CHIP8_EVENT_FAULT) && !state.fault_reported) {
+        if (state.trace)
+            chip8_trace_dump(state.trace, TRACE_FILE);
+        state.fault_reported = true;
+        sapp_request_quit();
+    }
+
+    if (budget < SPEED_MULTIPLIER)
+        state.stats.frames_emulated++;
+
+    u64 render_start = stm_now();
+    state.stats.update_ns += stm_ns(stm_diff(render_start, frame_start));
 
     // == render =====================
 
     sgl_viewport(0, 0, sapp_width(), sapp_height(), true);
     sgl_defaults();
     
-    chip8_render();
+    chip8_render(&state.chip8);
+
+    // the display refresh rate can be anything, capture on a fixed clock
+    // so recordings play back at the right speed
+    if (state.capture) {
+        const u64 capture_period = 1000000000ull / CAPTURE_FPS;
+        for (state.capture_ns += frame_ns; state.capture_ns >= capture_period; state.capture_ns -= capture_period)
+            chip8_capture_frame(state.capture, state.chip8.display);
+    }
+
+    draw_debug_overlay();
+    draw_stats_overlay();
+
+    u64 commit_start = stm_now();
+    state.stats.render_ns += stm_ns(stm_diff(commit_start, render_start));
 
     sg_begin_default_pass(&state.pass_action, sapp_width(), sapp_height());
     sgl_draw();
     sg_end_pass();
     sg_commit();
+
+    state.stats.commit_ns += stm_ns(stm_since(commit_start));
+    state.stats.frames_presented++;
+    update_stats();
 }
 
 void input(const sapp_event *e) {
-    chip8_input(e);
+    if (e->type == SAPP_EVENTTYPE_KEY_DOWN) {
+        switch (e->key_code) {
+        // cycle through the anti-flicker modes
+        case SAPP_KEYCODE_F2:
+            state.phosphor_mode = (state.phosphor_mode + 1) % CHIP8_PHOSPHOR_COUNT;
+            chip8_set_phosphor(state.phosphor_mode, PHOSPHOR_BLEND_FRAMES);
+            break;
+
+        case SAPP_KEYCODE_F3:
+            state.show_stats = !state.show_stats;
+            break;
+
+        // dump the instruction trace on demand
+        case SAPP_KEYCODE_F9:
+            if (state.trace)
+                chip8_trace_dump(state.trace, TRACE_FILE);
+            break;
+
+        // debugger
+        case SAPP_KEYCODE_F5:
+            if (chip8_debug_state(&state.chip8) == CHIP8_DEBUG_RUNNING)
+                chip8_debug_pause(&state.chip8);
+            else
+                chip8_debug_continue(&state.chip8);
+            break;
+        case SAPP_KEYCODE_F10: chip8_debug_step_over(&state.chip8); break;
+        case SAPP_KEYCODE_F11: chip8_debug_step(&state.chip8); break;
+
+        default: break;
+        }
+    }
+
+    chip8_input_event(&state.chip8, e);
+}
+
+void draw_debug_overlay(void) {
+    // frame the display while execution is stopped:
+    // red on breakpoints and watchpoints, yellow when paused or stepping
+    chip8_debug_state_t debug_state = chip8_debug_state(&state.chip8);
+    if (debug_state == CHIP8_DEBUG_RUNNING)
+        return;
+
+    sgl_disable_texture();
+    sgl_push_matrix();
+        sgl_scale(0.76f, 0.76f, 1.f);
+        sgl_begin_line_strip();
+            if (debug_state == CHIP8_DEBUG_BREAKPOINT || debug_state == CHIP8_DEBUG_WATCHPOINT)
+                sgl_c3f(0.9f, 0.1f, 0.1f);
+            else
+                sgl_c3f(0.9f, 0.8f, 0.1f);
+            sgl_v2f(-1.f, -1.f);
+            sgl_v2f(-1.f,  1.f);
+            sgl_v2f( 1.f,  1.f);
+            sgl_v2f( 1.f, -1.f);
+            sgl_v2f(-1.f, -1.f);
+        sgl_end();
+    sgl_pop_matrix();
+}
+
+void update_stats(void) {
+    state.stats.time_ns = stm_ns(stm_since(state.start_time));
+    state.stats.instructions = state.chip8.instructions;
+    state.stats.texture_bytes = chip8_render_uploaded();
+    state.stats.capture_dropped = chip8_capture_dropped(state.capture);
+
+    if (state.stats.time_ns - state.stats_last.time_ns < STATS_INTERVAL_NS)
+        return;
+
+    chip8_stats_diff(&state.stats, &state.stats_last, &state.stats_interval);
+    state.stats_last = state.stats;
+
+    if (state.stats_out) {
+        char line[512];
+        chip8_stats_format_json(&state.stats_interval, line, sizeof(line));
+        fprintf(state.stats_out, "%s\n", line);
+        fflush(state.stats_out);
+    }
+}
+
+// draws value in decimal with the chip8 font, returns the x after the last digit
+static float draw_number(float x, float y, u64 value) {
+    char digits[24];
+    int count = snprintf(digits, sizeof(digits), "%llu", (unsigned long long)value);
+
+    sgl_begin_quads();
+    for (int i = 0; i < count; ++i) {
+        const u8 *glyph = &fontset[(digits[i] - '0') * 5];
+        for (int row = 0; row < 5; ++row) {
+            for (int col = 0; col < 4; ++col) {
+                if (!(glyph[row] & (0x80 >> col)))
+                    continue;
+                float px = x + col * STATS_PIXEL;
+                float py = y + row * STATS_PIXEL;
+                sgl_v2f(px, py);
+                sgl_v2f(px + STATS_PIXEL, py);
+                sgl_v2f(px + STATS_PIXEL, py + STATS_PIXEL);
+                sgl_v2f(px, py + STATS_PIXEL);
+            }
+        }
+        x += 5 * STATS_PIXEL;
+    }
+    sgl_end();
+
+    return x + 3 * STATS_PIXEL;
+}
+
+static void draw_rect(float x, float y, float w, float h) {
+    sgl_begin_quads();
+        sgl_v2f(x, y);
+        sgl_v2f(x + w, y);
+        sgl_v2f(x + w, y + h);
+        sgl_v2f(x, y + h);
+    sgl_end();
+}
+
+void draw_stats_overlay(void) {
+    /* numbers from the last complete interval, colors tell them apart:
+     *   instructions per second
+     *   frames emulated (green), presented (white), dropped (red) per second
+     *   update (green), render (blue), commit (orange) in us per frame,
+     *   and the same as a bar against the refresh period
+     *   texture upload in KB per second (grey)
+     */
+    if (!state.show_stats)
+        return;
+
+    const chip8_stats_t *s = &state.stats_interval;
+    const float line = 8 * STATS_PIXEL;
+    const float bar_width = 120 * STATS_PIXEL;
+    u64 frames = s->frames_presented ? s->frames_presented : 1;
+    float x = 4 * STATS_PIXEL;
+    float y = 4 * STATS_PIXEL;
+
+    sgl_disable_texture();
+    sgl_matrix_mode_projection();
+    sgl_push_matrix();
+    sgl_load_identity();
+    sgl_ortho(0.f, (float)sapp_width(), (float)sapp_height(), 0.f, -1.f, 1.f);
+    sgl_matrix_mode_modelview();
+    sgl_push_matrix();
+    sgl_load_identity();
+
+    sgl_c3f(0.05f, 0.05f, 0.1f);
+    draw_rect(0.f, 0.f, bar_width + 8 * STATS_PIXEL, 5 * line + 4 * STATS_PIXEL);
+
+    sgl_c3f(1.f, 1.f, 1.f);
+    draw_number(x, y, (u64)chip8_stats_rate(s, s->instructions));
+    y += line;
+
+    sgl_c3f(0.3f, 0.9f, 0.3f);
+    float nx = draw_number(x, y, (u64)(chip8_stats_rate(s, s->frames_emulated) + 0.5));
+    sgl_c3f(1.f, 1.f, 1.f);
+    nx = draw_number(nx, y, (u64)(chip8_stats_rate(s, s->frames_presented) + 0.5));
+    sgl_c3f(0.9f, 0.2f, 0.2f);
+    draw_number(nx, y, s->frames_dropped);
+    y += line;
+
+    u64 times[3] = { s->update_ns / frames, s->render_ns / frames, s->commit_ns / frames };
+    const float colors[3][3] = { { 0.3f, 0.9f, 0.3f }, { 0.3f, 0.5f, 1.f }, { 1.f, 0.6f, 0.2f } };
+    nx = x;
+    for (int i = 0; i < 3; ++i) {
+        sgl_c3f(colors[i][0], colors[i][1], colors[i][2]);
+        nx = draw_number(nx, y, times[i] / 1000);
+    }
+    y += line;
+
+    // stacked bar, full width is one measured refresh period
+    float bx = x;
+    for (int i = 0; i < 3; ++i) {
+        float w = state.refresh_ns ? bar_width * (float)times[i] / (float)state.refresh_ns : 0.f;
+        if (bx + w > x + bar_width)
+            w = x + bar_width - bx;
+        sgl_c3f(colors[i][0], colors[i][1], colors[i][2]);
+        draw_rect(bx, y, w, 5 * STATS_PIXEL);
+        bx += w;
+    }
+    y += line;
+
+    sgl_c3f(0.6f, 0.6f, 0.6f);
+    draw_number(x, y, (u64)(chip8_stats_rate(s, s->texture_bytes) / 1024.0));
+
+    sgl_pop_matrix();
+    sgl_matrix_mode_projection();
+    sgl_pop_matrix();
+    sgl_matrix_mode_modelview();
 }
 
 void cleanup(void) {
+    if (state.stats_out && state.stats_out != stdout)
+        fclose(state.stats_out);
+    chip8_capture_close(state.capture);
+    chip8_capture_shutdown();
+    chip8_debug_close();
+    chip8_cleanup(&state.chip8);
+    chip8_trace_destroy(state.trace);
+    chip8_render_cleanup();
     sgl_shutdown();
     sg_shutdown();
 }
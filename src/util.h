@@ -0,0 +1,40 @@
+#ifndef CHIP8_UTIL_H
+#define CHIP8_UTIL_H
+
+#include <stdio.h>
+
+#include "types.h"
+
+// prints msg and jumps to the cleanup label tag
+#define PANIC(msg, tag) do { puts("ERROR: " msg "\n"); goto tag; } while(0)
+
+// little endian values in files and network messages
+
+static inline void write_u16(u8 *out, u16 value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+}
+
+static inline void write_u32(u8 *out, u32 value) {
+	write_u16(out, value & 0xFFFF);
+	write_u16(out + 2, value >> 16);
+}
+
+static inline void write_u64(u8 *out, u64 value) {
+	write_u32(out, (u32)value);
+	write_u32(out + 4, (u32)(value >> 32));
+}
+
+static inline u16 read_u16(const u8 *in) {
+	return (u16)(in[0] | (in[1] << 8));
+}
+
+static inline u32 read_u32(const u8 *in) {
+	return read_u16(in) | ((u32)read_u16(in + 2) << 16);
+}
+
+static inline u64 read_u64(const u8 *in) {
+	return read_u32(in) | ((u64)read_u32(in + 4) << 32);
+}
+
+#endif
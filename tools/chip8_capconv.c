@@ -0,0 +1,283 @@
+/* chip8-capconv: converts a capture written by chip8_capture to Y4M or GIF
+ * usage: chip8-capconv <capture file> <output .y4m|.gif> [scale]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "util.h"
+#include "chip8_capture.h"
+#include "chip8_delta.h"
+
+enum {
+	WIDTH = 64,
+	HEIGHT = 32,
+	GIF_MIN_DELAY = 2, // in 1/100 s, smaller delays get clamped by viewers
+};
+
+typedef struct {
+	FILE *out;
+	u32 scale;
+	u8 fps;
+	u8 gif;
+
+	// gif only
+	u64 pending[CHIP8_DELTA_ROWS];
+	u32 pending_frames;
+	u32 time_error; // remainder of frames * 100 / fps not yet emitted
+	u8 block[255];
+	u32 block_len;
+	u32 bits;
+	u32 bit_count;
+} writer_t;
+
+static inline u8 pixel(const u64 *rows, u32 x, u32 y) {
+	return (rows[y] >> (WIDTH - 1 - x)) & 1;
+}
+
+// == Y4M =====================================================
+
+static void y4m_header(writer_t *w) {
+	fprintf(w->out, "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", WIDTH * w->scale, HEIGHT * w->scale, w->fps);
+}
+
+static void y4m_frame(writer_t *w, const u64 *rows) {
+	u32 width = WIDTH * w->scale;
+	u32 height = HEIGHT * w->scale;
+	static u8 luma[WIDTH * HEIGHT * 16 * 16];
+
+	for (u32 y = 0; y < height; ++y) {
+		for (u32 x = 0; x < width; ++x)
+			luma[y * width + x] = pixel(rows, x / w->scale, y / w->scale) ? 255 : 0;
+	}
+
+	fputs("FRAME\n", w->out);
+	fwrite(luma, width * height, 1, w->out);
+
+	// neutral chroma
+	u32 chroma = ((width + 1) / 2) * ((height + 1) / 2) * 2;
+	for (u32 i = 0; i < chroma; ++i)
+		fputc(128, w->out);
+}
+
+// == GIF =====================================================
+
+/* The image data is LZW coded without compression: with a minimum code
+ * size of 2 every code is 3 bits wide and a clear code is sent every two
+ * pixels, before the code table grows past 3 bits.
+ */
+
+static void put_u16(FILE *out, u16 value) {
+	fputc(value & 0xFF, out);
+	fputc(value >> 8, out);
+}
+
+static void gif_flush_block(writer_t *w) {
+	if (w->block_len) {
+		fputc((int)w->block_len, w->out);
+		fwrite(w->block, w->block_len, 1, w->out);
+		w->block_len = 0;
+	}
+}
+
+static void gif_put_code(writer_t *w, u32 code) {
+	w->bits |= code << w->bit_count;
+	w->bit_count += 3;
+	while (w->bit_count >= 8) {
+		w->block[w->block_len++] = w->bits & 0xFF;
+		w->bits >>= 8;
+		w->bit_count -= 8;
+		if (w->block_len == sizeof(w->block))
+			gif_flush_block(w);
+	}
+}
+
+static void gif_header(writer_t *w) {
+	u16 width = (u16)(WIDTH * w->scale);
+	u16 height = (u16)(HEIGHT * w->scale);
+
+	fputs("GIF89a", w->out);
+	put_u16(w->out, width);
+	put_u16(w->out, height);
+	// global color table of 2 entries: black, white
+	fputc(0x80, w->out);
+	fputc(0, w->out);
+	fputc(0, w->out);
+	fputc(0x00, w->out); fputc(0x00, w->out); fputc(0x00, w->out);
+	fputc(0xFF, w->out); fputc(0xFF, w->out); fputc(0xFF, w->out);
+
+	// loop forever
+	fputc(0x21, w->out); fputc(0xFF, w->out); fputc(11, w->out);
+	fputs("NETSCAPE2.0", w->out);
+	fputc(3, w->out); fputc(1, w->out); put_u16(w->out, 0); fputc(0, w->out);
+}
+
+static void gif_write_image(writer_t *w, const u64 *rows, u16 delay) {
+	enum { CLEAR = 4, END = 5 };
+	u32 width = WIDTH * w->scale;
+	u32 height = HEIGHT * w->scale;
+
+	// graphic control extension
+	fputc(0x21, w->out); fputc(0xF9, w->out); fputc(4, w->out);
+	fputc(0, w->out);
+	put_u16(w->out, delay);
+	fputc(0, w->out); fputc(0, w->out);
+
+	// image descriptor
+	fputc(0x2C, w->out);
+	put_u16(w->out, 0);
+	put_u16(w->out, 0);
+	put_u16(w->out, (u16)width);
+	put_u16(w->out, (u16)height);
+	fputc(0, w->out);
+
+	fputc(2, w->out);
+	w->bits = w->bit_count = w->block_len = 0;
+
+	u32 count = 0;
+	for (u32 y = 0; y < height; ++y) {
+		for (u32 x = 0; x < width; ++x, ++count) {
+			if (count % 2 == 0)
+				gif_put_code(w, CLEAR);
+			gif_put_code(w, pixel(rows, x / w->scale, y / w->scale));
+		}
+	}
+	gif_put_code(w, END);
+
+	if (w->bit_count)
+		w->block[w->block_len++] = w->bits & 0xFF;
+	gif_flush_block(w);
+	fputc(0, w->out);
+}
+
+static void gif_flush(writer_t *w, u8 final) {
+	/* frames are merged until they last at least GIF_MIN_DELAY,
+	 * the latest frame of a merged group is shown
+	 */
+	u64 time = (u64)w->pending_frames * 100 + w->time_error;
+	u64 delay = time / w->fps;
+
+	if (!w->pending_frames || (delay < GIF_MIN_DELAY && !final))
+		return;
+
+	w->time_error = (u32)(time % w->fps);
+	w->pending_frames = 0;
+
+	// the delay field is 16 bits, a longer still is split over several
+	// copies of the frame, none of them short enough to get clamped
+	for (; delay > 0xFFFF; delay -= 0x8000)
+		gif_write_image(w, w->pending, 0x8000);
+	gif_write_image(w, w->pending, (u16)(delay ? delay : 1));
+}
+
+static void gif_frame(writer_t *w, const u64 *rows, u32 repeats) {
+	if (!memcmp(rows, w->pending, sizeof(w->pending))) {
+		w->pending_frames += repeats;
+		return;
+	}
+
+	gif_flush(w, 0);
+	memcpy(w->pending, rows, sizeof(w->pending));
+	w->pending_frames += repeats;
+}
+
+// ============================================================
+
+static void emit(writer_t *w, const u64 *rows, u32 repeats) {
+	if (w->gif) {
+		gif_frame(w, rows, repeats);
+		return;
+	}
+
+	for (u32 i = 0; i < repeats; ++i)
+		y4m_frame(w, rows);
+}
+
+int main(int argc, char **argv) {
+	int status = -1;
+
+	if (argc < 3) {
+		printf("usage: %s <capture file> <output .y4m|.gif> [scale]\n", argv[0]);
+		return status;
+	}
+
+	writer_t w = { .scale = argc > 3 ? (u32)atoi(argv[3]) : 1 };
+	if (w.scale < 1 || w.scale > 16)
+		PANIC("scale must be between 1 and 16", failed_args);
+
+	const char *ext = strrchr(argv[2], '.');
+	w.gif = ext && !strcmp(ext, ".gif");
+
+	FILE *in = fopen(argv[1], "rb");
+	if (!in)
+		PANIC("couldn't open capture file", failed_args);
+
+	u8 header[CHIP8_CAPTURE_HEADER_SIZE];
+	if (fread(header, sizeof(header), 1, in) != 1 || memcmp(header, "C8CP", 4) != 0)
+		PANIC("not a chip8 capture file", failed_header);
+
+	if (header[4] != CHIP8_CAPTURE_VERSION || header[5] != WIDTH || header[6] != HEIGHT || !header[7])
+		PANIC("unsupported capture format", failed_header);
+
+	w.fps = header[7];
+	w.out = fopen(argv[2], "wb");
+	if (!w.out)
+		PANIC("couldn't open output file", failed_header);
+
+	if (w.gif)
+		gif_header(&w);
+	else
+		y4m_header(&w);
+
+	u64 rows[CHIP8_DELTA_ROWS] = { 0 };
+	u32 frames = 0;
+	int type;
+
+	while ((type = fgetc(in)) != EOF) {
+		u8 buf[CHIP8_DELTA_MAX_SIZE];
+		u32 value = 0;
+
+		// varint argument of the record
+		for (u32 shift = 0; ; shift += 7) {
+			int c = fgetc(in);
+			if (c == EOF || shift > 28)
+				PANIC("truncated capture file", failed_read);
+			value |= (u32)(c & 0x7F) << shift;
+			if (!(c & 0x80))
+				break;
+		}
+
+		if (type == CHIP8_CAPTURE_REPEAT) {
+			emit(&w, rows, value);
+			frames += value;
+		}
+		else if (type == CHIP8_CAPTURE_DELTA) {
+			if (value > sizeof(buf) || fread(buf, value, 1, in) != 1)
+				PANIC("truncated capture file", failed_read);
+			if (chip8_delta_decode(buf, value, rows) != value)
+				PANIC("corrupt frame in capture file", failed_read);
+			emit(&w, rows, 1);
+			frames++;
+		}
+		else {
+			PANIC("unknown record in capture file", failed_read);
+		}
+	}
+
+	if (w.gif) {
+		gif_flush(&w, 1);
+		fputc(0x3B, w.out);
+	}
+
+	printf("converted %u frames (%.1f s)\n", frames, (double)frames / w.fps);
+	status = 0;
+
+failed_read:
+	fclose(w.out);
+failed_header:
+	fclose(in);
+failed_args:
+	return status;
+}
@@ -0,0 +1,78 @@
+/* chip8-tracedump: decodes and disassembles a trace written by chip8_trace_dump
+ * usage: chip8-tracedump <trace file> [last n instructions]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "util.h"
+#include "chip8_trace.h"
+#include "chip8_disasm.h"
+
+int main(int argc, char **argv) {
+	int status = -1;
+
+	if (argc < 2) {
+		printf("usage: %s <trace file> [last n instructions]\n", argv[0]);
+		return status;
+	}
+
+	FILE *f = fopen(argv[1], "rb");
+	if (!f)
+		PANIC("couldn't open trace file", failed_open);
+
+	u8 header[20];
+	if (fread(header, sizeof(header), 1, f) != 1 || memcmp(header, "C8TR", 4) != 0)
+		PANIC("not a chip8 trace file", failed_header);
+
+	if (read_u32(header + 4) != CHIP8_TRACE_VERSION)
+		PANIC("unsupported trace version", failed_header);
+
+	u32 count = read_u32(header + 8);
+	u64 total = read_u32(header + 12) | ((u64)read_u32(header + 16) << 32);
+	u32 skip = 0;
+
+	if (argc > 2) {
+		u32 last = (u32)strtoul(argv[2], NULL, 0);
+		if (last < count)
+			skip = count - last;
+	}
+
+	if (fseek(f, (long)skip * CHIP8_TRACE_ENTRY_SIZE, SEEK_CUR))
+		PANIC("couldn't seek in trace file", failed_header);
+
+	printf("; %u of %llu executed instructions\n", count - skip, (unsigned long long)total);
+
+	for (u32 i = skip; i < count; ++i) {
+		u8 buf[CHIP8_TRACE_ENTRY_SIZE];
+		if (fread(buf, sizeof(buf), 1, f) != 1)
+			PANIC("EOF reached before reading whole trace", failed_header);
+
+		u16 pc     = read_u16(buf + 0);
+		u16 opcode = read_u16(buf + 2);
+		u16 index  = read_u16(buf + 4);
+		u8 vx = buf[6];
+		u8 vf = buf[7];
+
+		char text[32];
+		chip8_disasm(opcode, text, sizeof(text));
+
+		// instruction number counting from the start of execution
+		u64 seq = total - count + i;
+		printf("%10llu  %03x  %04x  %-18s I=%03x", (unsigned long long)seq, pc, opcode, text, index);
+
+		int reg = chip8_disasm_dest_reg(opcode);
+		if (reg >= 0 && reg != 0xF)
+			printf(" V%X=%02x", reg, vx);
+		printf(" VF=%02x\n", vf);
+	}
+
+	status = 0;
+
+failed_header:
+	fclose(f);
+failed_open:
+	return status;
+}
@@ -0,0 +1,294 @@
+/* chip8-validate: runs two cores in lockstep on the same ROM, seed and
+ * input stream and checks that they stay identical.
+ * usage: chip8-validate <rom> [--steps N] [--every N] [--seed N] [--verify-hash] [--inject N]
+ *
+ * The reference core is chip8_update, one call per instruction; the core
+ * under test is chip8_run. Their state hashes are compared every N
+ * instructions. On a mismatch both are rewound to the last matching
+ * checkpoint and the divergence is bisected down to the first instruction
+ * that produced a different state, which is reported with both states.
+ *   --verify-hash  also checks the running hashes against a full rehash
+ *                  at every checkpoint
+ *   --inject N     corrupts V0 of the core under test after N instructions,
+ *                  to check the validator itself
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "types.h"
+#include "util.h"
+#include "chip8.h"
+#include "chip8_disasm.h"
+
+enum {
+	INPUT_PERIOD = 64, // instructions between chances of a key event
+	MAX_MEMORY_DIFFS = 16,
+};
+
+static struct {
+	u64 steps;
+	u64 every;
+	u32 seed;
+	u8 verify_hash;
+	u64 inject; // 0 for none
+} options = {
+	.steps = 10000000,
+	.every = 1000,
+	.seed = 1,
+};
+
+static u64 mix(u64 x) {
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ull;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebull;
+	x ^= x >> 31;
+	return x;
+}
+
+// == CORES ===================================================
+
+static void run_reference(chip8_t *c, u64 steps) {
+	for (u64 i = 0; i < steps && !c->faulted; ++i)
+		chip8_update(c);
+}
+
+static void run_batched(chip8_t *c, u64 steps) {
+	while (steps) {
+		u32 reason;
+		steps -= chip8_run(c, steps > 0xFFFFFFFF ? 0xFFFFFFFF : (u32)steps, &reason);
+		if (reason & CHIP8_EVENT_FAULT)
+			break;
+	}
+}
+
+/* runs both cores from instruction `from` for count instructions.
+ * key events only depend on the instruction number, so replaying from a
+ * snapshot sees the same input stream.
+ */
+static void advance(chip8_t *ref, chip8_t *test, u64 from, u64 count) {
+	u64 step = from;
+	u64 end = from + count;
+
+	while (step < end) {
+		if (step % INPUT_PERIOD == 0) {
+			u64 event = mix(options.seed ^ (step * 0x9e3779b97f4a7c15ull));
+			if ((event & 7) == 0) {
+				u8 key = (event >> 8) & 0xF;
+				u8 is_down = (event >> 12) & 1;
+				chip8_input(ref, key, is_down);
+				chip8_input(test, key, is_down);
+			}
+		}
+
+		u64 next = (step / INPUT_PERIOD + 1) * INPUT_PERIOD;
+		if (options.inject > step && options.inject < next)
+			next = options.inject;
+		if (next > end)
+			next = end;
+
+		run_reference(ref, next - step);
+		run_batched(test, next - step);
+		step = next;
+
+		if (step == options.inject)
+			test->registers[0] ^= 1;
+	}
+}
+
+// == REPORT ==================================================
+
+static void print_state_pair(const char *name, u32 a, u32 b, int width) {
+	printf("  %-6s %0*x  %0*x%s\n", name, width, a, width, b, a != b ? "  <--" : "");
+}
+
+static void report(const chip8_t *ref, const chip8_t *test) {
+	char name[8];
+
+	printf("  %-6s %-4s  %-4s\n", "", "ref", "test");
+	print_state_pair("pc", ref->pc, test->pc, 4);
+	print_state_pair("I", ref->index, test->index, 4);
+	for (u8 i = 0; i < 16; ++i) {
+		snprintf(name, sizeof(name), "V%X", i);
+		print_state_pair(name, ref->registers[i], test->registers[i], 4);
+	}
+	print_state_pair("sp", ref->sp, test->sp, 4);
+	for (u8 i = 0; i < ref->sp || i < test->sp; ++i) {
+		snprintf(name, sizeof(name), "s[%u]", i);
+		print_state_pair(name, ref->stack[i], test->stack[i], 4);
+	}
+	print_state_pair("delay", ref->delay_timer, test->delay_timer, 4);
+	print_state_pair("sound", ref->sound_timer, test->sound_timer, 4);
+	print_state_pair("rng", ref->rng, test->rng, 8);
+	print_state_pair("fault", ref->faulted, test->faulted, 4);
+
+	u32 memory_diffs = 0;
+	for (u16 address = 0; address < CHIP8_MEMORY_SIZE; ++address) {
+		u8 a = chip8_peek(ref, address);
+		u8 b = chip8_peek(test, address);
+		if (a == b)
+			continue;
+		if (memory_diffs++ < MAX_MEMORY_DIFFS)
+			printf("  [%03x]  %02x    %02x    <--\n", address, a, b);
+	}
+	if (memory_diffs > MAX_MEMORY_DIFFS)
+		printf("  ... %u more memory differences\n", memory_diffs - MAX_MEMORY_DIFFS);
+
+	for (u8 y = 0; y < CHIP8_DISPLAY_HEIGHT; ++y) {
+		if (ref->display[y] != test->display[y])
+			printf("  row %2u %016llx %016llx  <--\n", y,
+				(unsigned long long)ref->display[y], (unsigned long long)test->display[y]);
+	}
+}
+
+static u8 same_state(const chip8_t *ref, const chip8_t *test) {
+	return chip8_state_hash(ref) == chip8_state_hash(test);
+}
+
+// finds the first instruction after the snapshots where the cores differ
+static int bisect(const chip8_t *snap_ref, const chip8_t *snap_test, u64 from, u64 count) {
+	chip8_t ref, test;
+	u64 lo = 0;     // the cores match after lo instructions
+	u64 hi = count; // and differ after hi
+
+	while (hi - lo > 1) {
+		u64 mid = lo + (hi - lo) / 2;
+		if (chip8_clone(&ref, snap_ref))
+			PANIC("couldn't clone reference core", failed_ref);
+		if (chip8_clone(&test, snap_test))
+			PANIC("couldn't clone core under test", failed_test);
+
+		advance(&ref, &test, from, mid);
+		if (same_state(&ref, &test))
+			lo = mid;
+		else
+			hi = mid;
+
+		chip8_cleanup(&ref);
+		chip8_cleanup(&test);
+	}
+
+	// replay up to the diverging instruction and execute it
+	if (chip8_clone(&ref, snap_ref))
+		PANIC("couldn't clone reference core", failed_ref);
+	if (chip8_clone(&test, snap_test))
+		PANIC("couldn't clone core under test", failed_test);
+
+	advance(&ref, &test, from, hi - 1);
+	u16 pc = ref.pc;
+	u16 opcode = (chip8_peek(&ref, pc) << 8) | chip8_peek(&ref, pc + 1);
+	char text[32];
+	chip8_disasm(opcode, text, sizeof(text));
+
+	advance(&ref, &test, from + hi - 1, 1);
+	printf("cores diverge at instruction %llu (counting from 0): %03x  %04x  %s\n",
+		(unsigned long long)(from + hi - 1), pc, opcode, text);
+	report(&ref, &test);
+
+	chip8_cleanup(&test);
+	chip8_cleanup(&ref);
+	return 0;
+
+failed_test:
+	chip8_cleanup(&ref);
+failed_ref:
+	return -1;
+}
+
+// == MAIN ====================================================
+
+int main(int argc, char **argv) {
+	int status = -1;
+
+	if (argc < 2) {
+		printf("usage: %s <rom> [--steps N] [--every N] [--seed N] [--verify-hash] [--inject N]\n", argv[0]);
+		return status;
+	}
+
+	for (int i = 2; i < argc; ++i) {
+		if (!strcmp(argv[i], "--verify-hash"))
+			options.verify_hash = 1;
+		else if (i + 1 < argc && !strcmp(argv[i], "--steps"))
+			options.steps = strtoull(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "--every"))
+			options.every = strtoull(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "--seed"))
+			options.seed = (u32)strtoul(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "--inject"))
+			options.inject = strtoull(argv[++i], NULL, 0);
+	}
+	if (!options.every)
+		options.every = 1;
+
+	chip8_rom_t *rom = chip8_rom_load(argv[1]);
+	if (!rom)
+		PANIC("couldn't load ROM", failed_rom);
+
+	chip8_t ref, test, snap_ref, snap_test;
+	chip8_init(&ref);
+	chip8_init(&test);
+	chip8_load_rom(&ref, rom);
+	chip8_load_rom(&test, rom);
+	chip8_seed(&ref, options.seed);
+	chip8_seed(&test, options.seed);
+	chip8_hash_enable(&ref);
+	chip8_hash_enable(&test);
+
+	clock_t start = clock();
+	u64 step = 0;
+	u64 checkpoints = 0;
+
+	while (step < options.steps) {
+		u64 count = options.steps - step < options.every ? options.steps - step : options.every;
+
+		if (chip8_clone(&snap_ref, &ref))
+			PANIC("couldn't snapshot reference core", failed_snapshot);
+		if (chip8_clone(&snap_test, &test)) {
+			chip8_cleanup(&snap_ref);
+			PANIC("couldn't snapshot core under test", failed_snapshot);
+		}
+
+		advance(&ref, &test, step, count);
+		checkpoints++;
+
+		if (options.verify_hash) {
+			if (chip8_state_hash(&ref) != chip8_state_hash_full(&ref))
+				printf("running hash of the reference core is wrong after instruction %llu\n", (unsigned long long)(step + count));
+			if (chip8_state_hash(&test) != chip8_state_hash_full(&test))
+				printf("running hash of the core under test is wrong after instruction %llu\n", (unsigned long long)(step + count));
+		}
+
+		if (!same_state(&ref, &test)) {
+			bisect(&snap_ref, &snap_test, step, count);
+			chip8_cleanup(&snap_ref);
+			chip8_cleanup(&snap_test);
+			goto failed_diverged;
+		}
+
+		chip8_cleanup(&snap_ref);
+		chip8_cleanup(&snap_test);
+		step += count;
+
+		if (ref.faulted) {
+			printf("both cores faulted at %03x after %llu instructions\n", ref.pc, (unsigned long long)ref.instructions);
+			break;
+		}
+	}
+
+	double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+	printf("%llu instructions match (%llu checkpoints) in %.2f s, hash %016llx\n",
+		(unsigned long long)step, (unsigned long long)checkpoints, seconds,
+		(unsigned long long)chip8_state_hash(&ref));
+	status = 0;
+
+failed_diverged:
+failed_snapshot:
+	chip8_cleanup(&test);
+	chip8_cleanup(&ref);
+	chip8_rom_release(rom);
+failed_rom:
+	return status;
+}